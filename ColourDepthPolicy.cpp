@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <cstddef>
+#include <cstdio>
+
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "ColourDepthPolicy.h"
+
+
+namespace {
+
+// The link is congested when the backlog needs more than this to be delivered, and clear when it needs less than the other.
+const std::chrono::milliseconds CongestedDelay(500);
+const std::chrono::milliseconds ClearDelay(100);
+
+// How long the link has to stay congested or clear before the depth changes. Stepping up waits longer, so a recovering link is not flooded again right away.
+const std::chrono::seconds StepDownAfter(1);
+const std::chrono::seconds StepUpAfter(10);
+
+// Weight of a new sample in the throughput estimate.
+const double ThroughputWeight = 0.25;
+
+}
+
+ColourDepthPolicy::ColourDepthPolicy(int fd)
+    : m_fd(fd)
+{
+}
+
+bool ColourDepthPolicy::updateSent()
+{
+    Clock::time_point now = Clock::now();
+    m_backlog = queuedBytes();
+    measureThroughput();
+
+    // The client has the whole update only after everything queued before its end is delivered.
+    fprintf(stderr, "DBG backlog %zu thr %f\n", m_backlog, m_throughput);
+    Clock::duration delay = Clock::duration::zero();
+    if (m_throughput > 0) {
+        delay = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_backlog / m_throughput));
+    }
+
+    bool congested = delay > CongestedDelay;
+    bool clear = delay < ClearDelay;
+
+    if (congested && !m_congested) {
+        m_congestedSince = now;
+    }
+    if (clear && !m_clear) {
+        m_clearSince = now;
+    }
+    m_congested = congested;
+    m_clear = clear;
+
+    if (m_congested && m_depth > 8 && now - m_congestedSince >= StepDownAfter) {
+        m_depth -= 8;
+        m_congestedSince = now;
+        return true;
+    }
+
+    if (m_clear && m_depth < FullDepth && now - m_clearSince >= StepUpAfter) {
+        m_depth += 8;
+        m_clearSince = now;
+        return true;
+    }
+
+    return false;
+}
+
+std::size_t ColourDepthPolicy::queuedBytes() const
+{
+    // Bytes written to the socket that the peer didn't acknowledge yet.
+    int queued = 0;
+    if (ioctl(m_fd, TIOCOUTQ, &queued) == -1 || queued < 0) {
+        return 0;
+    }
+
+    return queued;
+}
+
+void ColourDepthPolicy::measureThroughput()
+{
+    tcp_info info;
+    socklen_t length = sizeof(info);
+    if (getsockopt(m_fd, IPPROTO_TCP, TCP_INFO, &info, &length) == -1 || length < offsetof(tcp_info, tcpi_delivery_rate) + sizeof(info.tcpi_delivery_rate)) {
+        return; // Not TCP or too old kernel, the link is never considered congested.
+    }
+
+    double rate = info.tcpi_delivery_rate;
+    if (rate <= 0) {
+        return;
+    }
+
+    // When we didn't have enough data to fill the link, the rate is only its lower bound.
+    if (info.tcpi_delivery_rate_app_limited) {
+        if (rate > m_throughput) {
+            m_throughput = rate;
+        }
+        return;
+    }
+
+    m_throughput = m_throughput ? m_throughput + ThroughputWeight * (rate - m_throughput) : rate;
+}
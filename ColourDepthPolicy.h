@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+
+#ifndef COLOURDEPTHPOLICY_H
+#define COLOURDEPTHPOLICY_H
+
+#include <chrono>
+#include <cstddef>
+
+
+/**
+ * @brief a class that decides how many colours to send to a client based on how well its link keeps up.
+ *
+ * After every update written to the client it looks at the backlog in the socket's send queue and at the delivery rate the kernel measures for the TCP connection.
+ * When the backlog would take too long to deliver for a while, it steps the colour depth down. Once it is delivered quickly for longer, it steps the depth back up.
+ * The two thresholds and the different time periods make a hysteresis, so the depth doesn't flap.
+ *
+ * The depth doesn't change the client's pixel format. Colours are only rounded to fewer levels when converted to it, which makes the encoded updates smaller.
+ *
+ * @remark This class is not thread-safe and is meant to be used by the VncTunnel that owns it.
+ */
+class ColourDepthPolicy
+{
+private:
+    typedef std::chrono::steady_clock Clock;
+
+public:
+    static constexpr int FullDepth = 24;
+
+    /**
+     * @param fd Socket connected to the client.
+     */
+    explicit ColourDepthPolicy(int fd);
+
+    /**
+     * Record that an update was written to the client.
+     * Returns true if the depth changed.
+     */
+    bool updateSent();
+
+    /**
+     * Colour depth the updates should be reduced to, 24, 16 or 8 bits.
+     */
+    int depth() const { return m_depth; }
+
+    /**
+     * Estimated throughput of the link in bytes per second, 0 if not known yet.
+     */
+    double throughput() const { return m_throughput; }
+
+    /**
+     * Bytes that were waiting for delivery after the last update.
+     */
+    std::size_t backlog() const { return m_backlog; }
+
+private:
+    std::size_t queuedBytes() const;
+    void measureThroughput();
+
+private:
+    int m_fd;
+    int m_depth = FullDepth;
+
+    std::size_t m_backlog = 0;
+    double m_throughput = 0;
+
+    Clock::time_point m_congestedSince;
+    Clock::time_point m_clearSince;
+    bool m_congested = false;
+    bool m_clear = false;
+};
+
+#endif // COLOURDEPTHPOLICY_H
@@ -117,9 +117,26 @@ bool Configuration::parse(int argc, char *argv[], const char *config)
         ("tls-cert",                 po::value<std::string>()->default_value("/etc/vnc/tls.cert"),          "path to certificate file")
         ("tls-key",                  po::value<std::string>()->default_value("/etc/vnc/tls.key"),           "path to key file")
         ("tls-priority-anonymous",   po::value<std::string>()->default_value("NORMAL:+ANON-ECDH:+ANON-DH"), "GNUTLS priority configuration for anonymous TLS")         // TODO: Verify the default value
-        ("tls-priority-certificate", po::value<std::string>()->default_value("NORMAL"),                     "GNUTLS priority configuration for TLS with certificate"); // TODO: Verify the default value
-
-    all.add(general).add(tls);
+        ("tls-priority-certificate", po::value<std::string>()->default_value("NORMAL"),                     "GNUTLS priority configuration for TLS with certificate") // TODO: Verify the default value
+        ("tls-session-tickets",      po::value<bool>()->default_value(true, "yes"),                         "Allow clients to resume TLS sessions using session tickets.")
+        ("tls-ticket-key-rotation",  po::value<unsigned>()->default_value(3600),                            "Number of seconds after which the session ticket key is rotated.")
+        ("tls-ticket-key-file",      po::value<std::string>(),                                              "path to file with secret shared by vncmanager instances that should resume each other's TLS sessions")
+        ("tls-handshake-threads",    po::value<unsigned>()->default_value(0),                               "Maximal number of TLS handshakes running at once. 0 means number of CPUs.")
+        ("tls-handshake-queue",      po::value<unsigned>()->default_value(64),                              "Maximal number of TLS handshakes waiting for a free thread. Clients above the limit are disconnected.")
+        ("tls-handshake-timeout",    po::value<unsigned>()->default_value(10),                              "Number of seconds after which unfinished TLS handshake is aborted.")
+        ("tls-encryption-thread",    po::value<bool>()->default_value(false, "no"),                         "If set, data sent to TLS clients are encrypted in a separate thread of each client.")
+        ("tls-encryption-queue",     po::value<unsigned>()->default_value(8),                               "Number of 64 KiB batches that can wait for the encryption thread.");
+
+    po::options_description framebuffer("Framebuffer");
+    framebuffer.add_options()
+        ("shadow-framebuffer",     po::value<bool>()->default_value(false, "no"), "If set, vncmanager keeps a copy of the framebuffer for each client and sends it only the latest content of changed areas.")
+        ("reconnect-grace-period", po::value<unsigned>()->default_value(0),       "Seconds to keep the session of a disconnected client ready for its reconnection. Requires shadow-framebuffer. 0 disables it.")
+        ("fan-out",                po::value<bool>()->default_value(false, "no"), "If set, all clients viewing the same session share one connection to Xvnc. Requires shadow-framebuffer.")
+        ("encoder-threads",        po::value<unsigned>()->default_value(0),       "Number of threads that encode updates from shadow framebuffer. 0 means number of CPUs.")
+        ("translate-pixels",       po::value<bool>()->default_value(false, "no"), "If set, Xvnc keeps its native pixel format and vncmanager translates pixels to the client's format.")
+        ("adaptive-colour-depth",  po::value<bool>()->default_value(false, "no"), "If set, clients on congested links get updates with fewer colours. Requires shadow-framebuffer.");
+
+    all.add(general).add(tls).add(framebuffer);
 
     po::store(po::parse_command_line(argc, argv, all), options);
     std::ifstream config_file(options["config"].as<std::string>());
@@ -171,6 +188,12 @@ void Configuration::check()
         if(access(tls_key.c_str(), R_OK) < 0)
             throw_errno(tls_key);
     }
+
+    if(options.count("tls-ticket-key-file") > 0) {
+        std::string tls_ticket_key_file = options["tls-ticket-key-file"].as<std::string>();
+        if(access(tls_ticket_key_file.c_str(), R_OK) < 0)
+            throw_errno(tls_ticket_key_file);
+    }
 }
 
 boost::program_options::variables_map Configuration::options;
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <zlib.h>
+
+#include <cstring>
+#include <stdexcept>
+
+#include "DeflateStreams.h"
+
+
+namespace {
+
+/**
+ * Deflate stream owned by each encoding thread.
+ */
+struct Deflater {
+    z_stream stream;
+    int level = Z_DEFAULT_COMPRESSION;
+
+    Deflater() {
+        std::memset(&stream, 0, sizeof(stream));
+        if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("Failed to initialize zlib stream.");
+        }
+    }
+
+    ~Deflater() {
+        deflateEnd(&stream);
+    }
+};
+
+}
+
+
+void DeflateStreams::compress(const uint8_t *data, std::size_t length, int level, std::vector<uint8_t> &output)
+{
+    static thread_local Deflater deflater;
+
+    z_stream &stream = deflater.stream;
+    deflateReset(&stream);
+
+    if (level != deflater.level) {
+        deflateParams(&stream, level, Z_DEFAULT_STRATEGY);
+        deflater.level = level;
+    }
+
+    stream.next_in = const_cast<uint8_t *>(data);
+    stream.avail_in = length;
+
+    std::size_t chunkSize = deflateBound(&stream, length) + 16;
+    do {
+        std::size_t offset = output.size();
+        output.resize(offset + chunkSize);
+
+        stream.next_out = &output[offset];
+        stream.avail_out = chunkSize;
+
+        // Sync flush ends the data on byte boundary without ending the stream, so the next chunk can continue it.
+        if (deflate(&stream, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+            throw std::runtime_error("Failed to compress data.");
+        }
+
+        output.resize(output.size() - stream.avail_out);
+    } while (stream.avail_out == 0);
+}
+
+void DeflateStreams::writeCompactLength(std::size_t length, std::vector<uint8_t> &output)
+{
+    output.push_back((length & 0x7f) | 0x80);
+    output.push_back(((length >> 7) & 0x7f) | 0x80);
+    output.push_back(length >> 14);
+}
+
+void DeflateStreams::start(std::vector<uint8_t> &data, const std::vector<Chunk> &chunks)
+{
+    // zlib header for deflate with 32 KiB window.
+    static const uint8_t header[] = { 0x78, 0x01 };
+
+    std::size_t shift = 0;
+
+    for (const Chunk &chunk : chunks) {
+        if (!m_startedStreams.insert(std::make_pair(chunk.encoding, chunk.stream)).second) {
+            continue;
+        }
+
+        std::size_t lengthOffset = chunk.lengthOffset + shift;
+
+        if (chunk.encoding == EncodingType::ZRLE) {
+            uint32_t length;
+            std::memcpy(&length, &data[lengthOffset], sizeof(length));
+            length = htonl(ntohl(length) + sizeof(header));
+            std::memcpy(&data[lengthOffset], &length, sizeof(length));
+
+            data.insert(data.begin() + lengthOffset + sizeof(length), header, header + sizeof(header));
+        } else {
+            std::size_t length = (data[lengthOffset] & 0x7f) | ((data[lengthOffset + 1] & 0x7f) << 7) | (data[lengthOffset + 2] << 14);
+            length += sizeof(header);
+
+            data[lengthOffset] = (length & 0x7f) | 0x80;
+            data[lengthOffset + 1] = ((length >> 7) & 0x7f) | 0x80;
+            data[lengthOffset + 2] = length >> 14;
+
+            data.insert(data.begin() + lengthOffset + 3, header, header + sizeof(header));
+        }
+
+        shift += sizeof(header);
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef DEFLATESTREAMS_H
+#define DEFLATESTREAMS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "rfb.h"
+
+
+/**
+ * @brief zlib streams that a client keeps inflating for the whole connection.
+ *
+ * ZRLE and Tight send compressed data through zlib streams that are never reset. To allow compressing rectangles in parallel, every rectangle is compressed independently as raw deflate data ending with sync flush.
+ * Such chunks concatenated form a valid deflate stream, so the client's inflater sees one continuous stream. Only the first chunk of each stream must be preceded by the zlib header.
+ * Encoders don't know which chunk is sent first. They record position of each chunk and start() inserts the headers when the data are being sent in order.
+ *
+ * @remark Static methods are thread-safe. Otherwise this class is not thread-safe and requires external synchronization if shared between threads.
+ */
+class DeflateStreams
+{
+public:
+    /**
+     * @brief a compressed chunk in encoded data.
+     *
+     * The length of the chunk precedes it at lengthOffset. ZRLE uses 32 bit length, Tight uses 3 byte compact length.
+     */
+    struct Chunk {
+        std::size_t lengthOffset;
+        EncodingType encoding;
+        int stream;
+    };
+
+public:
+    /**
+     * Compress the data as raw deflate chunk and append it to output.
+     */
+    static void compress(const uint8_t *data, std::size_t length, int level, std::vector<uint8_t> &output);
+
+    /**
+     * Write Tight compact length taking always three bytes, so it can be adjusted by start().
+     */
+    static void writeCompactLength(std::size_t length, std::vector<uint8_t> &output);
+
+    /**
+     * @brief Insert zlib header in front of chunks that start their stream.
+     *
+     * Must be called for all encoded data in the order they are sent to the client.
+     */
+    void start(std::vector<uint8_t> &data, const std::vector<Chunk> &chunks);
+
+private:
+    std::set<std::pair<EncodingType, int>> m_startedStreams;
+};
+
+#endif // DEFLATESTREAMS_H
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <algorithm>
+
+#include "helper.h"
+#include "Configuration.h"
+#include "EncoderPool.h"
+#include "Log.h"
+
+
+EncoderPool::EncoderPool()
+{
+    unsigned threads = Configuration::options["encoder-threads"].as<unsigned>();
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    m_workers.resize(threads);
+    for (std::size_t i = 0; i < m_workers.size(); i++) {
+        m_workers[i].thread = start_thread(&EncoderPool::work, this, i);
+    }
+}
+
+EncoderPool::~EncoderPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+
+    for (auto &worker : m_workers) {
+        worker.thread.join();
+    }
+}
+
+void EncoderPool::run(std::vector<Task> &tasks)
+{
+    if (tasks.empty()) {
+        return;
+    }
+
+    Batch batch;
+    batch.remaining = tasks.size();
+
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    for (Task &task : tasks) {
+        Job job;
+        job.task = &task;
+        job.batch = &batch;
+
+        m_workers[m_nextWorker].queue.push_back(job);
+        m_nextWorker = (m_nextWorker + 1) % m_workers.size();
+    }
+
+    m_batchCount++;
+    m_taskCount += tasks.size();
+    m_condition.notify_all();
+
+    // Help with own batch, newest pieces first to not compete with workers for the front of their queues.
+    while (batch.remaining > 0) {
+        Job job;
+        bool found = false;
+
+        for (Worker &worker : m_workers) {
+            auto iter = std::find_if(worker.queue.rbegin(), worker.queue.rend(), [&batch](const Job &job) {
+                return job.batch == &batch;
+            });
+
+            if (iter != worker.queue.rend()) {
+                job = *iter;
+                worker.queue.erase(std::next(iter).base());
+                found = true;
+                break;
+            }
+        }
+
+        if (found) {
+            runJob(job, lock);
+        } else {
+            batch.finished.wait(lock);
+        }
+    }
+
+    if (batch.error) {
+        std::rethrow_exception(batch.error);
+    }
+}
+
+void EncoderPool::logStatistics() const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    Log::info() << "Encoder pool: " << m_workers.size() << " threads, " << m_batchCount << " batches, " << m_taskCount << " tasks, " << m_stealCount << " stolen" << std::endl;
+}
+
+void EncoderPool::work(std::size_t index)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (!m_stopping) {
+        Job job;
+        if (takeJob(index, job)) {
+            runJob(job, lock);
+        } else {
+            m_condition.wait(lock);
+        }
+    }
+}
+
+bool EncoderPool::takeJob(std::size_t index, Job &job)
+{
+    std::deque<Job> &own = m_workers[index].queue;
+    if (!own.empty()) {
+        job = own.front();
+        own.pop_front();
+        return true;
+    }
+
+    // Steal from the back of the queue of another worker.
+    for (std::size_t i = 1; i < m_workers.size(); i++) {
+        std::deque<Job> &other = m_workers[(index + i) % m_workers.size()].queue;
+        if (!other.empty()) {
+            job = other.back();
+            other.pop_back();
+            m_stealCount++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void EncoderPool::runJob(Job &job, std::unique_lock<std::mutex> &lock)
+{
+    std::exception_ptr error;
+
+    lock.unlock();
+    try {
+        (*job.task)();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    lock.lock();
+
+    Batch &batch = *job.batch;
+    if (error && !batch.error) {
+        batch.error = error;
+    }
+
+    if (--batch.remaining == 0) {
+        batch.finished.notify_all();
+    }
+}
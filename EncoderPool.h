@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef ENCODERPOOL_H
+#define ENCODERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * @brief a pool of worker threads that encode framebuffer updates.
+ *
+ * Tunnels split their updates into independent pieces and run them here, so a single large update uses all CPUs.
+ * Each worker has its own queue. Pieces of one batch are spread across the queues and workers that run out of work steal from the others. The thread that submitted the batch also works on it while it waits.
+ *
+ * @remark This class is thread-safe.
+ */
+class EncoderPool
+{
+public:
+    typedef std::function<void(void)> Task;
+
+public:
+    EncoderPool();
+
+    EncoderPool(const EncoderPool &) = delete;
+    EncoderPool &operator=(const EncoderPool &) = delete;
+
+    ~EncoderPool();
+
+    /**
+     * @brief Run all the tasks and wait for them to finish.
+     *
+     * Tasks may run in any order and in parallel. The first exception thrown by a task is rethrown in the calling thread after all tasks finished.
+     */
+    void run(std::vector<Task> &tasks);
+
+    /**
+     * Write number of batches, tasks and steals to the log.
+     */
+    void logStatistics() const;
+
+private:
+    struct Batch {
+        std::size_t remaining;
+        std::exception_ptr error;
+        std::condition_variable finished;
+    };
+
+    struct Job {
+        Task *task;
+        Batch *batch;
+    };
+
+    struct Worker {
+        std::deque<Job> queue;
+        std::thread thread;
+    };
+
+    void work(std::size_t index);
+    bool takeJob(std::size_t index, Job &job);
+    void runJob(Job &job, std::unique_lock<std::mutex> &lock);
+
+private:
+    mutable std::mutex m_lock;
+    std::condition_variable m_condition;
+
+    std::vector<Worker> m_workers;
+    std::size_t m_nextWorker = 0;
+    bool m_stopping = false;
+
+    unsigned long m_batchCount = 0;
+    unsigned long m_taskCount = 0;
+    unsigned long m_stealCount = 0;
+};
+
+#endif // ENCODERPOOL_H
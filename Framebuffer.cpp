@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "Framebuffer.h"
+
+
+Framebuffer::Framebuffer(int width, int height, const PixelFormat &pixelFormat)
+    : m_width(0)
+    , m_height(0)
+    , m_pixelFormat(pixelFormat)
+    , m_bytesPerPixel(pixelFormat.bytesPerPixel())
+    , m_stride(0)
+{
+    resize(width, height);
+}
+
+PixelFormat Framebuffer::nativePixelFormat()
+{
+    PixelFormat pixelFormat;
+    pixelFormat.bitsPerPixel = 32;
+    pixelFormat.depth = 24;
+    pixelFormat.bigEndianFlag = (__BYTE_ORDER == __BIG_ENDIAN);
+    pixelFormat.trueColourFlag = true;
+    pixelFormat.redMax = 255;
+    pixelFormat.greenMax = 255;
+    pixelFormat.blueMax = 255;
+    pixelFormat.redShift = 16;
+    pixelFormat.greenShift = 8;
+    pixelFormat.blueShift = 0;
+    return pixelFormat;
+}
+
+void Framebuffer::resize(int width, int height)
+{
+    if (width == m_width && height == m_height) {
+        return;
+    }
+
+    std::size_t stride = width * m_bytesPerPixel;
+    std::vector<uint8_t> data(stride * height, 0);
+
+    int keptWidth = std::min(width, m_width);
+    int keptHeight = std::min(height, m_height);
+    for (int y = 0; y < keptHeight; y++) {
+        memcpy(&data[y * stride], &m_data[y * m_stride], keptWidth * m_bytesPerPixel);
+    }
+
+    m_width = width;
+    m_height = height;
+    m_stride = stride;
+    m_data.swap(data);
+}
+
+void Framebuffer::fillRect(const Rect &rect, const uint8_t *pixel)
+{
+    if (rect.empty()) {
+        return;
+    }
+
+    uint8_t *firstRow = data(rect.x, rect.y);
+    for (int x = 0; x < rect.width; x++) {
+        memcpy(firstRow + x * m_bytesPerPixel, pixel, m_bytesPerPixel);
+    }
+
+    for (int y = 1; y < rect.height; y++) {
+        memcpy(firstRow + y * m_stride, firstRow, rect.width * m_bytesPerPixel);
+    }
+}
+
+void Framebuffer::copyRect(const Rect &rect, int srcX, int srcY)
+{
+    std::size_t rowLength = rect.width * m_bytesPerPixel;
+
+    // Go from the opposite end if the source is below the destination, so the rows are not overwritten before they are copied.
+    if (srcY < rect.y) {
+        for (int y = rect.height - 1; y >= 0; y--) {
+            memmove(data(rect.x, rect.y + y), data(srcX, srcY + y), rowLength);
+        }
+    } else {
+        for (int y = 0; y < rect.height; y++) {
+            memmove(data(rect.x, rect.y + y), data(srcX, srcY + y), rowLength);
+        }
+    }
+}
+
+void Framebuffer::putRect(const Rect &rect, const uint8_t *pixels)
+{
+    std::size_t rowLength = rect.width * m_bytesPerPixel;
+
+    for (int y = 0; y < rect.height; y++) {
+        memcpy(data(rect.x, rect.y + y), pixels + y * rowLength, rowLength);
+    }
+}
+
+void Framebuffer::copyFrom(const Framebuffer &another)
+{
+    std::lock_guard<std::mutex> guard(another.m_lock);
+
+    if (another.m_pixelFormat != m_pixelFormat) {
+        throw std::runtime_error("Can not copy framebuffer with different pixel format.");
+    }
+
+    m_width = another.m_width;
+    m_height = another.m_height;
+    m_stride = another.m_stride;
+    m_data = another.m_data;
+    m_cursor = another.m_cursor;
+}
+
+void Framebuffer::compare(const Framebuffer &another, const Rect &rect, Region &differences) const
+{
+    Rect clipped = rect.intersected(this->rect());
+
+    if (another.m_width != m_width || another.m_height != m_height || another.m_pixelFormat != m_pixelFormat) {
+        differences.add(clipped);
+        return;
+    }
+
+    // Compare tile by tile, the first difference in a tile is enough to mark it.
+    for (int tileY = clipped.y / Region::TileSize * Region::TileSize; tileY < clipped.bottom(); tileY += Region::TileSize) {
+        for (int tileX = clipped.x / Region::TileSize * Region::TileSize; tileX < clipped.right(); tileX += Region::TileSize) {
+            Rect tile = Rect(tileX, tileY, Region::TileSize, Region::TileSize).intersected(clipped);
+            std::size_t rowLength = tile.width * m_bytesPerPixel;
+
+            for (int y = tile.y; y < tile.bottom(); y++) {
+                if (memcmp(data(tile.x, y), another.data(tile.x, y), rowLength) != 0) {
+                    differences.add(tile);
+                    break;
+                }
+            }
+        }
+    }
+}
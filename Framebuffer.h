@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "rfb.h"
+#include "Region.h"
+
+
+/**
+ * @brief a copy of the screen content of one Xvnc session.
+ *
+ * The pixels are stored in a single pixel format, rows follow each other without any padding.
+ * Together with the pixels the framebuffer keeps the last cursor shape received from Xvnc.
+ *
+ * @remark This class is not thread-safe. A framebuffer is modified only by the thread that owns it, which holds mutex() while doing so. Other threads must hold mutex() while reading it.
+ */
+class Framebuffer
+{
+public:
+    /**
+     * @brief the cursor shape as received in Cursor or XCursor pseudo-encoding.
+     *
+     * Data of the Cursor pseudo-encoding are in the pixel format of the framebuffer.
+     */
+    struct Cursor {
+        EncodingType encoding = EncodingType::Cursor;
+        int hotspotX = 0;
+        int hotspotY = 0;
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> data;
+        bool valid = false;
+    };
+
+public:
+    Framebuffer(int width, int height, const PixelFormat &pixelFormat);
+
+    Framebuffer(const Framebuffer &) = delete;
+    Framebuffer &operator=(const Framebuffer &) = delete;
+
+    /**
+     * Pixel format used by vncmanager for framebuffers it keeps: 32 bits per pixel, 8 bits per color channel, host byte order.
+     */
+    static PixelFormat nativePixelFormat();
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    Rect rect() const { return Rect(0, 0, m_width, m_height); }
+
+    const PixelFormat &pixelFormat() const { return m_pixelFormat; }
+    int bytesPerPixel() const { return m_bytesPerPixel; }
+    std::size_t stride() const { return m_stride; }
+
+    uint8_t *data(int x, int y) { return &m_data[y * m_stride + x * m_bytesPerPixel]; }
+    const uint8_t *data(int x, int y) const { return &m_data[y * m_stride + x * m_bytesPerPixel]; }
+
+    /**
+     * Change size of the framebuffer. Content that fits into the new size is kept, the rest is black.
+     */
+    void resize(int width, int height);
+
+    /**
+     * Fill rectangle with single pixel value.
+     */
+    void fillRect(const Rect &rect, const uint8_t *pixel);
+
+    /**
+     * Copy rectangle from the position (srcX, srcY) to the position of the given rectangle. The areas may overlap.
+     */
+    void copyRect(const Rect &rect, int srcX, int srcY);
+
+    /**
+     * Replace content of the rectangle with given pixels. The rows of the pixels must follow each other without padding.
+     */
+    void putRect(const Rect &rect, const uint8_t *pixels);
+
+    /**
+     * Replace size, content and cursor of this framebuffer with those of another framebuffer of the same pixel format.
+     * Locks the mutex of the other framebuffer while copying.
+     */
+    void copyFrom(const Framebuffer &another);
+
+    /**
+     * Add tiles inside of the rectangle in which this and another framebuffer of the same size and pixel format differ to the region.
+     */
+    void compare(const Framebuffer &another, const Rect &rect, Region &differences) const;
+
+    Cursor &cursor() { return m_cursor; }
+    const Cursor &cursor() const { return m_cursor; }
+
+    std::mutex &mutex() const { return m_lock; }
+
+private:
+    mutable std::mutex m_lock;
+
+    int m_width;
+    int m_height;
+
+    PixelFormat m_pixelFormat;
+    int m_bytesPerPixel;
+    std::size_t m_stride;
+
+    std::vector<uint8_t> m_data;
+
+    Cursor m_cursor;
+};
+
+#endif // FRAMEBUFFER_H
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+
+/**
+ * @brief a set of up to 256 pixel values with their indexes.
+ *
+ * Encoders use it to find out whether an area can be sent as palette. Pixel values are looked up in a small open addressing hash table.
+ *
+ * @remark This class is not thread-safe and requires external synchronization if shared between threads.
+ */
+class Palette
+{
+public:
+    static constexpr std::size_t MaxSize = 256;
+
+public:
+    Palette() { clear(); }
+
+    void clear() {
+        std::memset(m_indices, -1, sizeof(m_indices));
+        m_size = 0;
+    }
+
+    std::size_t size() const { return m_size; }
+    uint32_t colour(std::size_t index) const { return m_colours[index]; }
+
+    /**
+     * Add the pixel value to the palette. Returns false if it is not there and the palette is full.
+     */
+    bool insert(uint32_t colour) {
+        std::size_t slot = find(colour);
+        if (m_indices[slot] >= 0) {
+            return true;
+        }
+
+        if (m_size == MaxSize) {
+            return false;
+        }
+
+        m_keys[slot] = colour;
+        m_indices[slot] = m_size;
+        m_colours[m_size++] = colour;
+        return true;
+    }
+
+    /**
+     * Index of pixel value that is in the palette.
+     */
+    uint8_t index(uint32_t colour) const {
+        return m_indices[find(colour)];
+    }
+
+private:
+    static constexpr std::size_t HashSize = 1024;
+
+    std::size_t find(uint32_t colour) const {
+        std::size_t slot = (colour * 2654435761u) >> 22;
+        while (m_indices[slot] >= 0 && m_keys[slot] != colour) {
+            slot = (slot + 1) % HashSize;
+        }
+        return slot;
+    }
+
+private:
+    uint32_t m_keys[HashSize];
+    int16_t m_indices[HashSize];
+    uint32_t m_colours[MaxSize];
+    std::size_t m_size;
+};
+
+#endif // PALETTE_H
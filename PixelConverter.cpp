@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <string.h>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "PixelConverter.h"
+
+
+namespace {
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && (defined(__SSE2__) || defined(__ARM_NEON))
+constexpr bool HaveVectorKernels = true;
+#else
+constexpr bool HaveVectorKernels = false;
+#endif
+
+bool isVectorizable(const PixelFormat &from, const PixelFormat &to)
+{
+    if (!HaveVectorKernels || from.bitsPerPixel != 32 || from.bigEndianFlag || from.redMax != 255 || from.greenMax != 255 || from.blueMax != 255) {
+        return false;
+    }
+
+    if (to.bitsPerPixel != 16 && to.bitsPerPixel != 8) {
+        return false;
+    }
+
+    // Every scaled channel must fit into the output pixel.
+    uint32_t limit = to.bitsPerPixel == 16 ? 0xffff : 0xff;
+    for (auto channel : { std::make_pair(to.redMax, to.redShift), std::make_pair(to.greenMax, to.greenShift), std::make_pair(to.blueMax, to.blueShift) }) {
+        if (channel.first > 255 || (uint32_t)channel.first << channel.second > limit) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The kernels scale a channel as (value * toMax + 127) / 255, exactly like the tables. The division is done as (x + 1 + (x >> 8)) >> 8, which is exact for x < 65535.
+
+#if defined(__AVX2__)
+inline __m256i scaleChannel(__m256i low, __m256i high, int fromShift, uint16_t toMax, int toShift)
+{
+    __m256i mask = _mm256_set1_epi32(0xff);
+    __m128i shift = _mm_cvtsi32_si128(fromShift);
+
+    // Packing works within 128 bit lanes, the pixels come out interleaved. The caller puts them back in order.
+    __m256i value = _mm256_packs_epi32(_mm256_and_si256(_mm256_srl_epi32(low, shift), mask), _mm256_and_si256(_mm256_srl_epi32(high, shift), mask));
+    __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(value, _mm256_set1_epi16(toMax)), _mm256_set1_epi16(127));
+    __m256i scaled = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, _mm256_set1_epi16(1)), _mm256_srli_epi16(x, 8)), 8);
+    return _mm256_sll_epi16(scaled, _mm_cvtsi32_si128(toShift));
+}
+#elif defined(__SSE2__)
+inline __m128i scaleChannel(__m128i low, __m128i high, int fromShift, uint16_t toMax, int toShift)
+{
+    __m128i mask = _mm_set1_epi32(0xff);
+    __m128i shift = _mm_cvtsi32_si128(fromShift);
+
+    __m128i value = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(low, shift), mask), _mm_and_si128(_mm_srl_epi32(high, shift), mask));
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(value, _mm_set1_epi16(toMax)), _mm_set1_epi16(127));
+    __m128i scaled = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8);
+    return _mm_sll_epi16(scaled, _mm_cvtsi32_si128(toShift));
+}
+#elif defined(__ARM_NEON)
+inline uint16x8_t scaleChannel(uint32x4_t low, uint32x4_t high, int fromShift, uint16_t toMax, int toShift)
+{
+    uint32x4_t mask = vdupq_n_u32(0xff);
+    int32x4_t shift = vdupq_n_s32(-fromShift);
+
+    uint16x8_t value = vcombine_u16(vmovn_u32(vandq_u32(vshlq_u32(low, shift), mask)), vmovn_u32(vandq_u32(vshlq_u32(high, shift), mask)));
+    uint16x8_t x = vmlaq_u16(vdupq_n_u16(127), value, vdupq_n_u16(toMax));
+    uint16x8_t scaled = vshrq_n_u16(vaddq_u16(vaddq_u16(x, vdupq_n_u16(1)), vshrq_n_u16(x, 8)), 8);
+    return vshlq_u16(scaled, vdupq_n_s16(toShift));
+}
+#endif
+
+}
+
+
+
+PixelConverter::PixelConverter(const PixelFormat &from, const PixelFormat &to, int colourDepth)
+    : m_from(from)
+    , m_to(to)
+    , m_colourDepth(colourDepth)
+    , m_fromBytesPerPixel(from.bytesPerPixel())
+    , m_toBytesPerPixel(to.bytesPerPixel())
+    , m_identity(from == to && colourDepth >= 24)
+    , m_vectorizable(!m_identity && colourDepth >= 24 && isVectorizable(from, to))
+{
+    if (!m_identity) {
+        uint16_t redLevels = 255, greenLevels = 255, blueLevels = 255;
+        if (colourDepth < 24) {
+            redLevels = colourDepth < 16 ? 7 : 31;
+            greenLevels = colourDepth < 16 ? 7 : 63;
+            blueLevels = colourDepth < 16 ? 3 : 31;
+        }
+
+        m_redTable = prepareTable(from.redMax, to.redMax, to.redShift, redLevels);
+        m_greenTable = prepareTable(from.greenMax, to.greenMax, to.greenShift, greenLevels);
+        m_blueTable = prepareTable(from.blueMax, to.blueMax, to.blueShift, blueLevels);
+    }
+}
+
+void PixelConverter::convert(const uint8_t *src, uint8_t *dst, std::size_t count) const
+{
+    if (m_identity) {
+        memcpy(dst, src, count * m_fromBytesPerPixel);
+        return;
+    }
+
+    if (m_vectorizable) {
+        std::size_t converted = convertVector(src, dst, count);
+        src += converted * m_fromBytesPerPixel;
+        dst += converted * m_toBytesPerPixel;
+        count -= converted;
+    }
+
+    bool fromBigEndian = m_from.bigEndianFlag;
+    bool toBigEndian = m_to.bigEndianFlag;
+
+    for (std::size_t i = 0; i < count; i++) {
+        uint32_t pixel = readPixel(src, m_fromBytesPerPixel, fromBigEndian);
+
+        uint32_t converted =
+            m_redTable[(pixel >> m_from.redShift) & m_from.redMax] |
+            m_greenTable[(pixel >> m_from.greenShift) & m_from.greenMax] |
+            m_blueTable[(pixel >> m_from.blueShift) & m_from.blueMax];
+
+        writePixel(dst, converted, m_toBytesPerPixel, toBigEndian);
+
+        src += m_fromBytesPerPixel;
+        dst += m_toBytesPerPixel;
+    }
+}
+
+std::size_t PixelConverter::convertVector(const uint8_t *src, uint8_t *dst, std::size_t count) const
+{
+    // Converts whole blocks of pixels, the rest is left to the scalar loop.
+    bool swap = m_to.bigEndianFlag && m_toBytesPerPixel == 2;
+    std::size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 16 <= count; i += 16) {
+        __m256i low = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        __m256i high = _mm256_loadu_si256((const __m256i *)(src + i * 4 + 32));
+
+        __m256i pixels = _mm256_or_si256(_mm256_or_si256(
+            scaleChannel(low, high, m_from.redShift, m_to.redMax, m_to.redShift),
+            scaleChannel(low, high, m_from.greenShift, m_to.greenMax, m_to.greenShift)),
+            scaleChannel(low, high, m_from.blueShift, m_to.blueMax, m_to.blueShift));
+        pixels = _mm256_permute4x64_epi64(pixels, 0xd8);
+
+        if (m_toBytesPerPixel == 2) {
+            if (swap) {
+                pixels = _mm256_or_si256(_mm256_slli_epi16(pixels, 8), _mm256_srli_epi16(pixels, 8));
+            }
+            _mm256_storeu_si256((__m256i *)(dst + i * 2), pixels);
+        } else {
+            __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(pixels, pixels), 0x08);
+            _mm_storeu_si128((__m128i *)(dst + i), _mm256_castsi256_si128(bytes));
+        }
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i low = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        __m128i high = _mm_loadu_si128((const __m128i *)(src + i * 4 + 16));
+
+        __m128i pixels = _mm_or_si128(_mm_or_si128(
+            scaleChannel(low, high, m_from.redShift, m_to.redMax, m_to.redShift),
+            scaleChannel(low, high, m_from.greenShift, m_to.greenMax, m_to.greenShift)),
+            scaleChannel(low, high, m_from.blueShift, m_to.blueMax, m_to.blueShift));
+
+        if (m_toBytesPerPixel == 2) {
+            if (swap) {
+                pixels = _mm_or_si128(_mm_slli_epi16(pixels, 8), _mm_srli_epi16(pixels, 8));
+            }
+            _mm_storeu_si128((__m128i *)(dst + i * 2), pixels);
+        } else {
+            _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(pixels, pixels));
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        uint32x4_t low = vld1q_u32((const uint32_t *)(src + i * 4));
+        uint32x4_t high = vld1q_u32((const uint32_t *)(src + i * 4 + 16));
+
+        uint16x8_t pixels = vorrq_u16(vorrq_u16(
+            scaleChannel(low, high, m_from.redShift, m_to.redMax, m_to.redShift),
+            scaleChannel(low, high, m_from.greenShift, m_to.greenMax, m_to.greenShift)),
+            scaleChannel(low, high, m_from.blueShift, m_to.blueMax, m_to.blueShift));
+
+        if (m_toBytesPerPixel == 2) {
+            if (swap) {
+                pixels = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(pixels)));
+            }
+            vst1q_u16((uint16_t *)(dst + i * 2), pixels);
+        } else {
+            vst1_u8(dst + i, vmovn_u16(pixels));
+        }
+    }
+#else
+    (void)src;
+    (void)dst;
+    (void)count;
+    (void)swap;
+#endif
+
+    return i;
+}
+
+uint32_t PixelConverter::readPixel(const uint8_t *src, int bytesPerPixel, bool bigEndian)
+{
+    uint32_t pixel = 0;
+    if (bigEndian) {
+        for (int i = 0; i < bytesPerPixel; i++) {
+            pixel = (pixel << 8) | src[i];
+        }
+    } else {
+        for (int i = bytesPerPixel - 1; i >= 0; i--) {
+            pixel = (pixel << 8) | src[i];
+        }
+    }
+    return pixel;
+}
+
+void PixelConverter::writePixel(uint8_t *dst, uint32_t pixel, int bytesPerPixel, bool bigEndian)
+{
+    if (bigEndian) {
+        for (int i = bytesPerPixel - 1; i >= 0; i--) {
+            dst[i] = pixel & 0xff;
+            pixel >>= 8;
+        }
+    } else {
+        for (int i = 0; i < bytesPerPixel; i++) {
+            dst[i] = pixel & 0xff;
+            pixel >>= 8;
+        }
+    }
+}
+
+std::vector<uint32_t> PixelConverter::prepareTable(uint16_t fromMax, uint16_t toMax, uint8_t toShift, uint16_t levelMax)
+{
+    // Reducing to fewer levels only makes sense if both formats have more.
+    bool reduce = levelMax < fromMax && levelMax < toMax;
+
+    std::vector<uint32_t> table(fromMax + 1);
+    for (uint32_t value = 0; value <= fromMax; value++) {
+        uint32_t scaled;
+        if (reduce) {
+            uint32_t level = (value * levelMax + fromMax / 2) / fromMax;
+            scaled = (level * toMax + levelMax / 2) / levelMax;
+        } else {
+            scaled = fromMax ? (value * toMax + fromMax / 2) / fromMax : 0;
+        }
+        table[value] = scaled << toShift;
+    }
+    return table;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef PIXELCONVERTER_H
+#define PIXELCONVERTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rfb.h"
+
+
+/**
+ * @brief a class that translates pixels from one true colour pixel format to another.
+ *
+ * Color channels are scaled using lookup tables prepared in the constructor, so the conversion of each pixel is only few table lookups.
+ * If both formats are the same, the pixels are just copied.
+ * Conversions from 32 bit pixels with 8 bit channels to 16 or 8 bit pixels, the common case of Xvnc's native format and low colour clients, use SIMD kernels selected at compile time (AVX2, SSE2 or NEON). They produce the same values as the tables.
+ *
+ * @remark This class is not thread-safe and requires external synchronization if shared between threads.
+ */
+class PixelConverter
+{
+public:
+    /**
+     * Colours can be reduced to given depth on the way, 16 bits keeps 5, 6 and 5 bits of red, green and blue, 8 bits keeps 3, 3 and 2 bits.
+     * Depth 24 keeps all colours.
+     */
+    PixelConverter(const PixelFormat &from, const PixelFormat &to, int colourDepth = 24);
+
+    const PixelFormat &from() const { return m_from; }
+    const PixelFormat &to() const { return m_to; }
+    int colourDepth() const { return m_colourDepth; }
+    bool identity() const { return m_identity; }
+
+    /**
+     * Convert count pixels from src to dst. The buffers must not overlap.
+     */
+    void convert(const uint8_t *src, uint8_t *dst, std::size_t count) const;
+
+private:
+    std::size_t convertVector(const uint8_t *src, uint8_t *dst, std::size_t count) const;
+
+    static uint32_t readPixel(const uint8_t *src, int bytesPerPixel, bool bigEndian);
+    static void writePixel(uint8_t *dst, uint32_t pixel, int bytesPerPixel, bool bigEndian);
+
+    static std::vector<uint32_t> prepareTable(uint16_t fromMax, uint16_t toMax, uint8_t toShift, uint16_t levelMax);
+
+private:
+    PixelFormat m_from;
+    PixelFormat m_to;
+    int m_colourDepth;
+
+    int m_fromBytesPerPixel;
+    int m_toBytesPerPixel;
+
+    bool m_identity;
+    bool m_vectorizable;
+
+    std::vector<uint32_t> m_redTable;
+    std::vector<uint32_t> m_greenTable;
+    std::vector<uint32_t> m_blueTable;
+};
+
+#endif // PIXELCONVERTER_H
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdexcept>
+
+#include "RectangleDecoder.h"
+
+
+bool RectangleDecoder::canDecode(EncodingType encoding)
+{
+    switch (encoding) {
+    case EncodingType::Raw:
+    case EncodingType::CopyRect:
+    case EncodingType::RRE:
+    case EncodingType::Cursor:
+    case EncodingType::XCursor:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+Rect RectangleDecoder::decode(StreamFormatter &fmt, const FramebufferUpdateRectangle &rectangle, Framebuffer &framebuffer)
+{
+    Rect rect(rectangle.xPosition, rectangle.yPosition, rectangle.width, rectangle.height);
+
+    if (rectangle.encodingType == EncodingType::Cursor || rectangle.encodingType == EncodingType::XCursor) {
+        decodeCursor(fmt, rectangle, framebuffer);
+        return Rect();
+    }
+
+    if (!framebuffer.rect().contains(rect)) {
+        throw std::runtime_error("Xvnc sent rectangle outside of the framebuffer.");
+    }
+
+    switch (rectangle.encodingType) {
+    case EncodingType::Raw:
+        decodeRaw(fmt, rect, framebuffer);
+        break;
+
+    case EncodingType::CopyRect:
+        decodeCopyRect(fmt, rect, framebuffer);
+        break;
+
+    case EncodingType::RRE:
+        decodeRRE(fmt, rect, framebuffer);
+        break;
+
+    default:
+        throw std::runtime_error("Can not decode rectangle with encoding " + std::to_string((int32_t)rectangle.encodingType) + ".");
+    }
+
+    return rect;
+}
+
+void RectangleDecoder::decodeRaw(StreamFormatter &fmt, const Rect &rect, Framebuffer &framebuffer)
+{
+    std::size_t rowLength = rect.width * framebuffer.bytesPerPixel();
+    for (int y = 0; y < rect.height; y++) {
+        fmt.recv_raw(framebuffer.data(rect.x, rect.y + y), rowLength);
+    }
+}
+
+void RectangleDecoder::decodeCopyRect(StreamFormatter &fmt, const Rect &rect, Framebuffer &framebuffer)
+{
+    uint16_t srcX, srcY;
+    fmt.recv(srcX);
+    fmt.recv(srcY);
+
+    if (!framebuffer.rect().contains(Rect(srcX, srcY, rect.width, rect.height))) {
+        throw std::runtime_error("Xvnc sent CopyRect with source outside of the framebuffer.");
+    }
+
+    framebuffer.copyRect(rect, srcX, srcY);
+}
+
+void RectangleDecoder::decodeRRE(StreamFormatter &fmt, const Rect &rect, Framebuffer &framebuffer)
+{
+    int bytesPerPixel = framebuffer.bytesPerPixel();
+
+    uint32_t numberOfSubrectangles;
+    fmt.recv(numberOfSubrectangles);
+
+    m_buffer.resize(bytesPerPixel);
+    fmt.recv_raw(m_buffer.data(), bytesPerPixel);
+    framebuffer.fillRect(rect, m_buffer.data());
+
+    // Subrectangles are read all at once, every one of them is a pixel followed by four 16 bit numbers.
+    std::size_t subrectangleSize = bytesPerPixel + 8;
+    m_buffer.resize(numberOfSubrectangles * subrectangleSize);
+    fmt.recv_raw(m_buffer.data(), m_buffer.size());
+
+    for (uint32_t i = 0; i < numberOfSubrectangles; i++) {
+        const uint8_t *subrectangle = &m_buffer[i * subrectangleSize];
+        const uint8_t *geometry = subrectangle + bytesPerPixel;
+
+        Rect subrect(
+            rect.x + (geometry[0] << 8 | geometry[1]),
+            rect.y + (geometry[2] << 8 | geometry[3]),
+            geometry[4] << 8 | geometry[5],
+            geometry[6] << 8 | geometry[7]
+        );
+
+        framebuffer.fillRect(subrect.intersected(rect), subrectangle);
+    }
+}
+
+void RectangleDecoder::decodeCursor(StreamFormatter &fmt, const FramebufferUpdateRectangle &rectangle, Framebuffer &framebuffer)
+{
+    std::size_t maskSize = (rectangle.width + 7) / 8 * rectangle.height;
+    std::size_t dataSize;
+
+    if (rectangle.encodingType == EncodingType::Cursor) {
+        dataSize = rectangle.width * rectangle.height * framebuffer.bytesPerPixel() + maskSize;
+    } else {
+        dataSize = (rectangle.width && rectangle.height) ? 6 + maskSize * 2 : 0;
+    }
+
+    Framebuffer::Cursor &cursor = framebuffer.cursor();
+    cursor.encoding = rectangle.encodingType;
+    cursor.hotspotX = rectangle.xPosition;
+    cursor.hotspotY = rectangle.yPosition;
+    cursor.width = rectangle.width;
+    cursor.height = rectangle.height;
+    cursor.data.resize(dataSize);
+    fmt.recv_raw(cursor.data.data(), dataSize);
+    cursor.valid = true;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef RECTANGLEDECODER_H
+#define RECTANGLEDECODER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "rfb.h"
+#include "Framebuffer.h"
+#include "Region.h"
+#include "StreamFormatter.h"
+
+
+/**
+ * @brief a class that reads framebuffer update rectangles from Xvnc and applies them to a Framebuffer.
+ *
+ * Only the encodings that vncmanager asks Xvnc for when it keeps a shadow framebuffer are supported.
+ * The pixel format of the received data must match the pixel format of the framebuffer.
+ *
+ * @remark This class is not thread-safe and requires external synchronization if shared between threads.
+ */
+class RectangleDecoder
+{
+public:
+    /**
+     * Whether given encoding carries framebuffer or cursor data that can be decoded.
+     */
+    static bool canDecode(EncodingType encoding);
+
+    /**
+     * Read data of the rectangle from the stream and apply them to the framebuffer.
+     *
+     * @return The area of the framebuffer that was changed. Empty for cursor shape changes.
+     */
+    Rect decode(StreamFormatter &fmt, const FramebufferUpdateRectangle &rectangle, Framebuffer &framebuffer);
+
+private:
+    void decodeRaw(StreamFormatter &fmt, const Rect &rect, Framebuffer &framebuffer);
+    void decodeCopyRect(StreamFormatter &fmt, const Rect &rect, Framebuffer &framebuffer);
+    void decodeRRE(StreamFormatter &fmt, const Rect &rect, Framebuffer &framebuffer);
+    void decodeCursor(StreamFormatter &fmt, const FramebufferUpdateRectangle &rectangle, Framebuffer &framebuffer);
+
+private:
+    std::vector<uint8_t> m_buffer;
+};
+
+#endif // RECTANGLEDECODER_H
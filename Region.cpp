@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include "Region.h"
+
+
+constexpr int Region::TileSize;
+
+
+Region::Region(int width, int height)
+{
+    resize(width, height);
+}
+
+void Region::resize(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+    m_columns = (width + TileSize - 1) / TileSize;
+    m_rows = (height + TileSize - 1) / TileSize;
+
+    m_tiles.assign(m_columns * m_rows, 0);
+    m_count = 0;
+}
+
+void Region::add(const Rect &rect)
+{
+    int column0, row0, column1, row1;
+    if (!tileRange(rect, false, column0, row0, column1, row1)) {
+        return;
+    }
+
+    for (int row = row0; row < row1; row++) {
+        uint8_t *tile = &m_tiles[row * m_columns + column0];
+        for (int column = column0; column < column1; column++, tile++) {
+            m_count += !*tile;
+            *tile = 1;
+        }
+    }
+}
+
+void Region::add(const Region &another)
+{
+    if (another.m_tiles.size() != m_tiles.size()) {
+        add(another.bounds());
+        return;
+    }
+
+    for (std::size_t i = 0; i < m_tiles.size(); i++) {
+        if (another.m_tiles[i] && !m_tiles[i]) {
+            m_tiles[i] = 1;
+            m_count++;
+        }
+    }
+}
+
+void Region::subtract(const Rect &rect)
+{
+    int column0, row0, column1, row1;
+    if (!tileRange(rect, true, column0, row0, column1, row1)) {
+        return;
+    }
+
+    for (int row = row0; row < row1; row++) {
+        uint8_t *tile = &m_tiles[row * m_columns + column0];
+        for (int column = column0; column < column1; column++, tile++) {
+            m_count -= *tile;
+            *tile = 0;
+        }
+    }
+}
+
+void Region::clear()
+{
+    std::fill(m_tiles.begin(), m_tiles.end(), 0);
+    m_count = 0;
+}
+
+bool Region::intersects(const Rect &rect) const
+{
+    int column0, row0, column1, row1;
+    if (empty() || !tileRange(rect, false, column0, row0, column1, row1)) {
+        return false;
+    }
+
+    for (int row = row0; row < row1; row++) {
+        const uint8_t *tile = &m_tiles[row * m_columns + column0];
+        for (int column = column0; column < column1; column++, tile++) {
+            if (*tile) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+Rect Region::bounds() const
+{
+    Rect result;
+    for (const Rect &rect : rects()) {
+        result = result.united(rect);
+    }
+    return result;
+}
+
+std::vector<Rect> Region::rects(const Rect &clip) const
+{
+    std::vector<Rect> result;
+
+    int column0, row0, column1, row1;
+    if (empty() || !tileRange(clip, false, column0, row0, column1, row1)) {
+        return result;
+    }
+
+    // Rectangles (in tiles) that may still grow downwards. A run of tiles in the next row extends a rectangle if it spans exactly the same columns.
+    std::vector<Rect> open, stillOpen;
+
+    auto close = [&](const Rect &tiles) {
+        Rect pixels(tiles.x * TileSize, tiles.y * TileSize, tiles.width * TileSize, tiles.height * TileSize);
+        pixels = pixels.intersected(clip);
+        if (!pixels.empty()) {
+            result.push_back(pixels);
+        }
+    };
+
+    for (int row = row0; row < row1; row++) {
+        stillOpen.clear();
+
+        const uint8_t *tiles = &m_tiles[row * m_columns];
+        std::size_t next = 0; // Open rectangles are ordered by column, so they can be matched in one pass.
+
+        for (int column = column0; column < column1;) {
+            if (!tiles[column]) {
+                column++;
+                continue;
+            }
+
+            int start = column;
+            while (column < column1 && tiles[column]) {
+                column++;
+            }
+
+            while (next < open.size() && open[next].x < start) {
+                close(open[next++]);
+            }
+
+            if (next < open.size() && open[next].x == start && open[next].width == column - start) {
+                Rect extended = open[next++];
+                extended.height++;
+                stillOpen.push_back(extended);
+            } else {
+                stillOpen.push_back(Rect(start, row, column - start, 1));
+            }
+        }
+
+        while (next < open.size()) {
+            close(open[next++]);
+        }
+
+        std::swap(open, stillOpen);
+    }
+
+    for (const Rect &rect : open) {
+        close(rect);
+    }
+
+    return result;
+}
+
+bool Region::tileRange(const Rect &rect, bool onlyComplete, int &column0, int &row0, int &column1, int &row1) const
+{
+    Rect clipped = rect.intersected(Rect(0, 0, m_width, m_height));
+    if (clipped.empty()) {
+        return false;
+    }
+
+    if (onlyComplete) {
+        column0 = (clipped.x + TileSize - 1) / TileSize;
+        row0 = (clipped.y + TileSize - 1) / TileSize;
+        column1 = (clipped.right() == m_width) ? m_columns : clipped.right() / TileSize;
+        row1 = (clipped.bottom() == m_height) ? m_rows : clipped.bottom() / TileSize;
+    } else {
+        column0 = clipped.x / TileSize;
+        row0 = clipped.y / TileSize;
+        column1 = (clipped.right() + TileSize - 1) / TileSize;
+        row1 = (clipped.bottom() + TileSize - 1) / TileSize;
+    }
+
+    return column0 < column1 && row0 < row1;
+}
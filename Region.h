@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef REGION_H
+#define REGION_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * @brief a rectangle in framebuffer coordinates.
+ */
+struct Rect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    Rect() = default;
+    Rect(int x, int y, int width, int height)
+        : x(x), y(y), width(width), height(height)
+    {}
+
+    int right() const { return x + width; }
+    int bottom() const { return y + height; }
+    int area() const { return width * height; }
+
+    bool empty() const { return width <= 0 || height <= 0; }
+
+    Rect intersected(const Rect &another) const {
+        int left = std::max(x, another.x);
+        int top = std::max(y, another.y);
+        int newRight = std::min(right(), another.right());
+        int newBottom = std::min(bottom(), another.bottom());
+
+        if (newRight <= left || newBottom <= top) {
+            return Rect();
+        }
+
+        return Rect(left, top, newRight - left, newBottom - top);
+    }
+
+    Rect united(const Rect &another) const {
+        if (empty()) {
+            return another;
+        }
+        if (another.empty()) {
+            return *this;
+        }
+
+        int left = std::min(x, another.x);
+        int top = std::min(y, another.y);
+        return Rect(left, top, std::max(right(), another.right()) - left, std::max(bottom(), another.bottom()) - top);
+    }
+
+    bool contains(const Rect &another) const {
+        return another.x >= x && another.y >= y && another.right() <= right() && another.bottom() <= bottom();
+    }
+
+    bool operator==(const Rect &another) const {
+        return x == another.x && y == another.y && width == another.width && height == another.height;
+    }
+
+    bool operator!=(const Rect &another) const {
+        return !(*this == another);
+    }
+};
+
+/**
+ * @brief a set of areas of the framebuffer.
+ *
+ * The framebuffer is divided into square tiles and the region remembers which tiles it contains. Adding a rectangle adds every tile it touches, so the region may be slightly larger than what was added.
+ * This keeps all operations cheap and independent of how many rectangles were added.
+ *
+ * @remark This class is not thread-safe and requires external synchronization if shared between threads.
+ */
+class Region
+{
+public:
+    static constexpr int TileSize = 16;
+
+public:
+    Region() = default;
+    Region(int width, int height);
+
+    /**
+     * Change size of the area covered by the region. The region is emptied.
+     */
+    void resize(int width, int height);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    /**
+     * Add every tile touched by the rectangle.
+     */
+    void add(const Rect &rect);
+
+    /**
+     * Add all tiles of another region of the same size.
+     */
+    void add(const Region &another);
+
+    /**
+     * Remove tiles that lie completely inside of the rectangle. Tiles at the right and bottom border are considered complete if the rectangle reaches the border.
+     */
+    void subtract(const Rect &rect);
+
+    /**
+     * Remove all tiles.
+     */
+    void clear();
+
+    bool empty() const { return m_count == 0; }
+
+    bool intersects(const Rect &rect) const;
+
+    /**
+     * Bounding rectangle of all tiles.
+     */
+    Rect bounds() const;
+
+    /**
+     * Return the region as list of non-overlapping rectangles clipped to given rectangle.
+     * Neighbouring tiles are merged into as few rectangles as cheaply possible.
+     */
+    std::vector<Rect> rects(const Rect &clip) const;
+
+    std::vector<Rect> rects() const {
+        return rects(Rect(0, 0, m_width, m_height));
+    }
+
+private:
+    bool tileRange(const Rect &rect, bool onlyComplete, int &column0, int &row0, int &column1, int &row1) const;
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    int m_columns = 0;
+    int m_rows = 0;
+
+    std::vector<uint8_t> m_tiles;
+    std::size_t m_count = 0;
+};
+
+#endif // REGION_H
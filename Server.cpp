@@ -160,7 +160,7 @@ void Server::accept(int listenfd)
         throw_errno();
     }
 
-    VncTunnel *tunnel = new VncTunnel(m_vncManager, m_greeterManager, m_controlManager, fd);
+    VncTunnel *tunnel = new VncTunnel(m_vncManager, m_greeterManager, m_controlManager, m_tlsSessionTickets, m_tlsHandshakePool, m_sessionFeedManager, m_encoderPool, fd);
     std::thread(&VncTunnel::start, tunnel).detach();
 }
 
@@ -172,6 +172,7 @@ void Server::prepareSignals()
     sigaddset(&sigmask, SIGTERM);
     sigaddset(&sigmask, SIGPIPE);
     sigaddset(&sigmask, SIGCHLD);
+    sigaddset(&sigmask, SIGUSR1);
 
     if (sigprocmask(SIG_BLOCK, &sigmask, nullptr) < 0) {
         throw_errno();
@@ -183,6 +184,14 @@ void Server::prepareSignals()
     }
 }
 
+void Server::logStatistics()
+{
+    m_tlsSessionTickets.logStatistics();
+    m_tlsHandshakePool.logStatistics();
+    m_sessionFeedManager.logStatistics();
+    m_encoderPool.logStatistics();
+}
+
 void Server::handleSignal()
 {
     struct signalfd_siginfo siginfo;
@@ -213,6 +222,10 @@ void Server::handleSignal()
         }
         break;
 
+    case SIGUSR1:
+        logStatistics();
+        break;
+
     case SIGPIPE:
         // Ignoring SIGPIPEs of greeters.
         // TODO: Any other SIGPIPEs we could potentially get?
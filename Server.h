@@ -34,7 +34,11 @@
 
 #include "helper.h"
 #include "ControllerManager.h"
+#include "EncoderPool.h"
 #include "GreeterManager.h"
+#include "SessionFeedManager.h"
+#include "TLSHandshakePool.h"
+#include "TLSSessionTickets.h"
 #include "XvncManager.h"
 
 
@@ -74,10 +78,19 @@ private:
     void prepareSignals();
     void handleSignal();
 
+    /**
+     * Write statistics of all components to the log. Triggered by SIGUSR1.
+     */
+    void logStatistics();
+
 private:
     XvncManager m_vncManager;
     GreeterManager m_greeterManager;
     ControllerManager m_controlManager;
+    TLSSessionTickets m_tlsSessionTickets;
+    TLSHandshakePool m_tlsHandshakePool;
+    SessionFeedManager m_sessionFeedManager;
+    EncoderPool m_encoderPool;
 
     bool m_run;
 
@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "helper.h"
+#include "Log.h"
+#include "SessionFeed.h"
+
+
+SessionFeed::Subscriber::Subscriber()
+    : m_eventFd(eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC)) // New subscriber starts with the current state of the feed to collect.
+{
+    if (m_eventFd < 0) {
+        throw_errno();
+    }
+}
+
+SessionFeed::Subscriber::~Subscriber()
+{
+    close(m_eventFd);
+}
+
+
+void SessionFeed::MessageStream::send(const void *buf, std::size_t len)
+{
+    const uint8_t *data = (const uint8_t *)buf;
+    m_buffer.insert(m_buffer.end(), data, data + len);
+}
+
+void SessionFeed::MessageStream::recv(void *buf, std::size_t len)
+{
+    throw std::logic_error("SessionFeed::MessageStream can not be read from.");
+}
+
+void SessionFeed::MessageStream::flush()
+{
+    if (m_buffer.empty()) {
+        return;
+    }
+
+    m_feed->send(m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+}
+
+int SessionFeed::MessageStream::takeFd()
+{
+    throw std::logic_error("SessionFeed::MessageStream has no file descriptor.");
+}
+
+
+SessionFeed::SessionFeed(std::unique_ptr<XvncConnection> connection, std::vector<EncodingType> cursorEncodings)
+    : m_connection(std::move(connection))
+    , m_xvnc(m_connection->xvnc())
+    , m_authenticated(m_connection->authenticated())
+    , m_cursorEncodings(cursorEncodings)
+{
+    // No other thread uses the connection yet, so there is no need for locking until the thread is started.
+
+    PixelFormat pixelFormat = Framebuffer::nativePixelFormat();
+    if (m_connection->pixelFormat() != pixelFormat) {
+        m_connection->sendSetPixelFormat(pixelFormat);
+    }
+
+    m_framebuffer = std::make_shared<Framebuffer>(m_connection->framebufferWidth(), m_connection->framebufferHeight(), pixelFormat);
+
+    // If another live connection to the same Xvnc keeps a framebuffer, start from its copy. Subscribers can get it right away and the full update from Xvnc then only corrects what changed meanwhile.
+    std::shared_ptr<Framebuffer> cachedFramebuffer = m_xvnc->cachedFramebuffer();
+    if (cachedFramebuffer) {
+        m_framebuffer->copyFrom(*cachedFramebuffer);
+        m_connection->setFramebufferSize(m_framebuffer->width(), m_framebuffer->height());
+
+        m_referenceFramebuffer.reset(new Framebuffer(m_framebuffer->width(), m_framebuffer->height(), pixelFormat));
+        m_referenceFramebuffer->copyFrom(*m_framebuffer);
+
+        m_complete = true;
+    }
+
+    sendSetEncodings();
+    m_connection->sendNonIncrementalFramebufferUpdateRequest();
+
+    m_thread = start_thread(&SessionFeed::run, this);
+}
+
+SessionFeed::~SessionFeed()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+    }
+
+    // Wake up the thread from reading.
+    shutdown(m_connection->stream().fd(), SHUT_RDWR);
+
+    m_thread.join();
+}
+
+std::shared_ptr<SessionFeed::Subscriber> SessionFeed::subscribe()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    std::shared_ptr<Subscriber> subscriber = std::make_shared<Subscriber>();
+
+    std::lock_guard<std::mutex> framebufferGuard(m_framebuffer->mutex());
+    subscriber->m_changes.damage.resize(m_framebuffer->width(), m_framebuffer->height());
+
+    // Until the first update arrives, the framebuffer has no content worth sending. The first update will mark everything anyway.
+    if (m_complete) {
+        subscriber->m_changes.damage.add(m_framebuffer->rect());
+    }
+    subscriber->m_changes.cursorChanged = m_framebuffer->cursor().valid;
+
+    m_subscribers.push_back(subscriber);
+
+    return subscriber;
+}
+
+void SessionFeed::unsubscribe(const std::shared_ptr<Subscriber> &subscriber)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    m_subscribers.erase(std::remove(m_subscribers.begin(), m_subscribers.end(), subscriber), m_subscribers.end());
+}
+
+std::vector<EncodingType> SessionFeed::cursorEncodings()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    return m_cursorEncodings;
+}
+
+bool SessionFeed::alive()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    return !m_error;
+}
+
+std::size_t SessionFeed::subscriberCount()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    return m_subscribers.size();
+}
+
+void SessionFeed::collect(Subscriber &subscriber, Changes &changes)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    uint64_t value;
+    if (read(subscriber.m_eventFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        throw_errno();
+    }
+
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
+
+    Changes &pending = subscriber.m_changes;
+
+    // After size change the pending damage covers the whole new framebuffer, what the subscriber still had is outdated.
+    if (changes.damage.width() != pending.damage.width() || changes.damage.height() != pending.damage.height()) {
+        changes.damage.resize(pending.damage.width(), pending.damage.height());
+    }
+    changes.damage.add(pending.damage);
+    pending.damage.clear();
+
+    changes.desktopSizeChanges.insert(changes.desktopSizeChanges.end(), pending.desktopSizeChanges.begin(), pending.desktopSizeChanges.end());
+    pending.desktopSizeChanges.clear();
+
+    changes.desktopNameChanged |= pending.desktopNameChanged;
+    pending.desktopNameChanged = false;
+
+    changes.cursorChanged |= pending.cursorChanged;
+    pending.cursorChanged = false;
+
+    changes.bells += pending.bells;
+    pending.bells = 0;
+
+    changes.cutTexts.insert(changes.cutTexts.end(), pending.cutTexts.begin(), pending.cutTexts.end());
+    pending.cutTexts.clear();
+}
+
+void SessionFeed::setCursorEncodings(const std::vector<EncodingType> &cursorEncodings)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        if (m_cursorEncodings == cursorEncodings) {
+            return;
+        }
+
+        m_cursorEncodings = cursorEncodings;
+    }
+
+    sendSetEncodings();
+}
+
+void SessionFeed::send(const void *buf, std::size_t len)
+{
+    std::lock_guard<std::mutex> guard(m_sendLock);
+
+    m_connection->stream().send(buf, len);
+}
+
+void SessionFeed::run()
+{
+    StreamFormatter &fmt = m_connection->fmt();
+
+    try {
+        while (true) {
+            ServerMessageType messageType;
+            fmt.recv(messageType);
+            fmt.push_back(messageType);
+
+            switch (messageType) {
+            case ServerMessageType::FramebufferUpdate:
+                receiveFramebufferUpdate();
+                break;
+
+            case ServerMessageType::Bell: {
+                BellMessage message;
+                fmt.recv(message);
+
+                std::lock_guard<std::mutex> guard(m_lock);
+                changeAll([](Changes &changes) {
+                    changes.bells++;
+                });
+                break;
+            }
+
+            case ServerMessageType::ServerCutText: {
+                ServerCutTextMessage message;
+                fmt.recv(message);
+                std::string text = fmt.recv_string(message.length);
+
+                std::lock_guard<std::mutex> guard(m_lock);
+                changeAll([&text](Changes &changes) {
+                    changes.cutTexts.push_back(text);
+                });
+                break;
+            }
+
+            case ServerMessageType::SetColourMapEntries:
+                throw std::runtime_error("SetColourMapEntries is not implemented!");
+
+            default:
+                throw std::runtime_error("Received unknown message type from Xvnc");
+            }
+        }
+    } catch (std::exception &e) {
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        if (!m_stopping) {
+            Log::notice() << "Connection to Xvnc #" << m_xvnc->id() << " failed: " << e.what() << std::endl;
+        }
+
+        m_error = std::make_exception_ptr(std::runtime_error(std::string("Connection to Xvnc failed: ") + e.what()));
+        changeAll([](Changes &) {});
+    }
+}
+
+void SessionFeed::receiveFramebufferUpdate()
+{
+    StreamFormatter &fmt = m_connection->fmt();
+
+    FramebufferUpdateMessage message;
+    fmt.recv(message);
+
+    Region damage(m_framebuffer->width(), m_framebuffer->height());
+    std::vector<DesktopSizeChange> desktopSizeChanges;
+    bool desktopNameChanged = false;
+    bool cursorChanged = false;
+
+    {
+        std::lock_guard<std::mutex> framebufferGuard(m_framebuffer->mutex());
+
+        for (int i = 0; i < message.numberOfRectangles; i++) {
+            FramebufferUpdateRectangle rectangle;
+            fmt.recv(rectangle);
+
+            if (rectangle.encodingType == EncodingType::LastRect) {
+                break;
+            }
+
+            if (RectangleDecoder::canDecode(rectangle.encodingType)) {
+                damage.add(m_rectangleDecoder.decode(fmt, rectangle, *m_framebuffer));
+
+                if (rectangle.encodingType == EncodingType::Cursor || rectangle.encodingType == EncodingType::XCursor) {
+                    cursorChanged = true;
+                }
+                continue;
+            }
+
+            switch (rectangle.encodingType) {
+            case EncodingType::DesktopSize:
+            case EncodingType::ExtendedDesktopSize: {
+                DesktopSizeChange change;
+                change.rectangle = rectangle;
+
+                if (rectangle.encodingType == EncodingType::ExtendedDesktopSize) {
+                    ExtendedDesktopSizeRectangleData rectangleData;
+                    fmt.recv(rectangleData);
+
+                    change.screens.resize(rectangleData.numberOfScreens);
+                    fmt.recv(change.screens);
+                }
+
+                if (rectangle.encodingType == EncodingType::DesktopSize || (ExtendedDesktopSizeStatus)rectangle.yPosition == ExtendedDesktopSizeStatus::NoError) {
+                    m_connection->setFramebufferSize(rectangle.width, rectangle.height);
+                    m_framebuffer->resize(rectangle.width, rectangle.height);
+
+                    damage.resize(rectangle.width, rectangle.height);
+                    damage.add(m_framebuffer->rect());
+                }
+
+                desktopSizeChanges.push_back(change);
+                break;
+            }
+
+            case EncodingType::DesktopName: {
+                uint32_t nameLength;
+                fmt.recv(nameLength);
+
+                m_connection->setDesktopName(fmt.recv_string(nameLength));
+                desktopNameChanged = true;
+                break;
+            }
+
+            default:
+                throw std::runtime_error("received unknown encoding!");
+                break;
+            }
+        }
+    }
+
+    // Keep Xvnc sending. Whatever comes is merged into the framebuffer even if the subscribers are not ready for it.
+    {
+        std::lock_guard<std::mutex> guard(m_sendLock);
+        m_connection->sendIncrementalFramebufferUpdateRequest();
+    }
+
+    if (m_referenceFramebuffer) {
+        // This was the full update requested after starting from a cached copy. Subscribers need only what differs from the copy.
+        damage.clear();
+        m_framebuffer->compare(*m_referenceFramebuffer, m_framebuffer->rect(), damage);
+        m_referenceFramebuffer.reset();
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    changeAll([&](Changes &changes) {
+        if (changes.damage.width() != damage.width() || changes.damage.height() != damage.height()) {
+            changes.damage.resize(damage.width(), damage.height());
+            changes.damage.add(Rect(0, 0, damage.width(), damage.height()));
+        }
+        changes.damage.add(damage);
+
+        changes.desktopSizeChanges.insert(changes.desktopSizeChanges.end(), desktopSizeChanges.begin(), desktopSizeChanges.end());
+        changes.desktopNameChanged |= desktopNameChanged;
+        changes.cursorChanged |= cursorChanged;
+    });
+
+    if (!m_registered) {
+        // The framebuffer is complete now, other connections to this Xvnc can start from it.
+        m_xvnc->registerFramebuffer(m_framebuffer);
+        m_registered = true;
+        m_complete = true;
+    }
+}
+
+void SessionFeed::sendSetEncodings()
+{
+    std::vector<EncodingType> encodings;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        encodings = m_cursorEncodings;
+    }
+
+    // Xvnc is local, so the cheapest encodings to produce and decode are the best.
+    encodings.push_back(EncodingType::Raw);
+    encodings.push_back(EncodingType::CopyRect);
+    encodings.push_back(EncodingType::RRE);
+
+    encodings.push_back(EncodingType::DesktopSize);
+    encodings.push_back(EncodingType::ExtendedDesktopSize);
+    encodings.push_back(EncodingType::LastRect);
+    encodings.push_back(EncodingType::DesktopName);
+
+    std::lock_guard<std::mutex> guard(m_sendLock);
+    m_connection->sendSetEncodings(encodings);
+}
+
+template<typename Function>
+void SessionFeed::changeAll(Function function)
+{
+    uint64_t value = 1;
+
+    for (auto &subscriber : m_subscribers) {
+        function(subscriber->m_changes);
+
+        // Can fail only if the counter would overflow, but then the subscriber is notified already.
+        [[gnu::unused]] ssize_t written = write(subscriber->m_eventFd, &value, sizeof(value));
+    }
+}
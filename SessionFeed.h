@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef SESSIONFEED_H
+#define SESSIONFEED_H
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rfb.h"
+#include "Framebuffer.h"
+#include "RectangleDecoder.h"
+#include "Region.h"
+#include "Stream.h"
+#include "Xvnc.h"
+#include "XvncConnection.h"
+
+
+/**
+ * @brief a class that keeps a shadow framebuffer of one Xvnc session up to date.
+ *
+ * SessionFeed owns an initialized XvncConnection and reads updates from it in its own thread. Xvnc is asked to send in the native pixel format of Framebuffer using only encodings vncmanager can decode.
+ * Changes of the session are collected separately for every subscriber. Subscribers are notified about new changes through a file descriptor that becomes readable, so they can wait for them in select together with their other file descriptors.
+ *
+ * The feed keeps running while there are no subscribers, see SessionFeedManager.
+ *
+ * @remark This class is thread-safe.
+ */
+class SessionFeed
+{
+public:
+    struct DesktopSizeChange {
+        FramebufferUpdateRectangle rectangle;
+        std::vector<SetDesktopSizeScreen> screens; // Used only with ExtendedDesktopSize.
+    };
+
+    /**
+     * @brief changes of the session that a subscriber didn't collect yet.
+     */
+    struct Changes {
+        Region damage;
+        std::vector<DesktopSizeChange> desktopSizeChanges;
+        bool desktopNameChanged = false;
+        bool cursorChanged = false;
+        unsigned bells = 0;
+        std::vector<std::string> cutTexts;
+    };
+
+    /**
+     * @brief a handle of one subscriber of the feed.
+     */
+    class Subscriber
+    {
+    public:
+        Subscriber();
+
+        Subscriber(const Subscriber &) = delete;
+        Subscriber &operator=(const Subscriber &) = delete;
+
+        ~Subscriber();
+
+        /**
+         * File descriptor that is readable when there are changes to collect.
+         */
+        int fd() const { return m_eventFd; }
+
+    private:
+        friend class SessionFeed;
+
+        int m_eventFd;
+        Changes m_changes;
+    };
+
+    /**
+     * @brief a write-only stream that sends client messages to the Xvnc of a feed.
+     *
+     * Several threads may send to the same Xvnc, so the data are collected and sent at once when flushed. Every flush must end with a complete message.
+     */
+    class MessageStream : public Stream
+    {
+    public:
+        void setFeed(std::shared_ptr<SessionFeed> feed) { m_feed = feed; }
+
+        virtual void send(const void *buf, std::size_t len);
+        virtual void recv(void *buf, std::size_t len);
+        virtual void flush();
+
+        virtual int fd() const { return -1; }
+        virtual int takeFd();
+
+    private:
+        std::shared_ptr<SessionFeed> m_feed;
+        std::vector<uint8_t> m_buffer;
+    };
+
+public:
+    /**
+     * @brief Construct new SessionFeed and start reading from the connection.
+     *
+     * @param connection Initialized connection to Xvnc. The feed becomes its owner.
+     * @param cursorEncodings Cursor pseudo-encodings Xvnc should use. If empty, Xvnc draws the cursor into the framebuffer.
+     */
+    SessionFeed(std::unique_ptr<XvncConnection> connection, std::vector<EncodingType> cursorEncodings);
+
+    SessionFeed(const SessionFeed &) = delete;
+    SessionFeed &operator=(const SessionFeed &) = delete;
+
+    ~SessionFeed();
+
+    std::shared_ptr<Xvnc> xvnc() const { return m_xvnc; }
+
+    /**
+     * Whether Xvnc required password or credentials to accept the connection.
+     */
+    bool authenticated() const { return m_authenticated; }
+
+    std::vector<EncodingType> cursorEncodings();
+
+    /**
+     * Whether the feed still receives from Xvnc.
+     */
+    bool alive();
+
+    std::size_t subscriberCount();
+
+    /**
+     * The shadow framebuffer. It is modified by the thread of the feed with its mutex locked.
+     */
+    Framebuffer &framebuffer() { return *m_framebuffer; }
+
+    std::string desktopName() const { return m_xvnc->desktopName(); }
+
+    /**
+     * Register new subscriber. The subscriber starts with the whole framebuffer and the cursor as changed.
+     */
+    std::shared_ptr<Subscriber> subscribe();
+
+    void unsubscribe(const std::shared_ptr<Subscriber> &subscriber);
+
+    /**
+     * Move changes that the subscriber didn't collect yet to the changes parameter, merging them with what it already contains.
+     * Rethrows the exception that stopped the feed, if it has stopped.
+     */
+    void collect(Subscriber &subscriber, Changes &changes);
+
+    /**
+     * Change the cursor pseudo-encodings Xvnc should use.
+     */
+    void setCursorEncodings(const std::vector<EncodingType> &cursorEncodings);
+
+    /**
+     * Send a complete client message to Xvnc.
+     */
+    void send(const void *buf, std::size_t len);
+
+private:
+    void run();
+    void receiveFramebufferUpdate();
+
+    void sendSetEncodings();
+
+    /**
+     * Call function for every subscriber's changes and notify the subscribers. Expects m_lock to be locked.
+     */
+    template<typename Function>
+    void changeAll(Function function);
+
+private:
+    std::mutex m_lock;
+    std::mutex m_sendLock;
+
+    std::unique_ptr<XvncConnection> m_connection;
+    std::shared_ptr<Xvnc> m_xvnc;
+    bool m_authenticated;
+
+    std::vector<EncodingType> m_cursorEncodings;
+
+    std::shared_ptr<Framebuffer> m_framebuffer;
+    std::unique_ptr<Framebuffer> m_referenceFramebuffer; // Cached content the framebuffer started from, until the first full update from Xvnc arrives.
+    RectangleDecoder m_rectangleDecoder;
+
+    std::vector<std::shared_ptr<Subscriber>> m_subscribers;
+
+    bool m_complete = false; // Whether the framebuffer has content from Xvnc.
+    bool m_registered = false; // Whether the framebuffer was registered in Xvnc as cached.
+
+    std::exception_ptr m_error;
+    bool m_stopping = false;
+
+    std::thread m_thread;
+};
+
+#endif // SESSIONFEED_H
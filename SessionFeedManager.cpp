@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <algorithm>
+#include <vector>
+
+#include "helper.h"
+#include "Configuration.h"
+#include "Log.h"
+#include "SessionFeedManager.h"
+
+
+SessionFeedManager::SessionFeedManager()
+    : m_gracePeriod(std::chrono::seconds(Configuration::options["reconnect-grace-period"].as<unsigned>()))
+    , m_fanOut(Configuration::options["fan-out"].as<bool>())
+{
+    if (m_gracePeriod != Clock::duration::zero()) {
+        m_thread = start_thread(&SessionFeedManager::expire, this);
+    }
+}
+
+SessionFeedManager::~SessionFeedManager()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void SessionFeedManager::park(std::shared_ptr<SessionFeed> feed, const std::string &clientAddress)
+{
+    if (m_gracePeriod == Clock::duration::zero() || feed->authenticated() || feed->subscriberCount() > 0 || !feed->alive()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        ParkedFeed parkedFeed;
+        parkedFeed.feed = feed;
+        parkedFeed.clientAddress = clientAddress;
+        parkedFeed.deadline = Clock::now() + m_gracePeriod;
+        m_parkedFeeds.push_back(parkedFeed);
+
+        m_parkedCount++;
+    }
+    m_condition.notify_all();
+
+    Log::debug() << "Keeping connection to Xvnc #" << feed->xvnc()->id() << " for reconnection from " << clientAddress << "." << std::endl;
+}
+
+std::shared_ptr<SessionFeed> SessionFeedManager::reclaim(const std::string &clientAddress)
+{
+    return reclaimIf([&clientAddress](const ParkedFeed &parkedFeed) {
+        return parkedFeed.clientAddress == clientAddress;
+    });
+}
+
+std::shared_ptr<SessionFeed> SessionFeedManager::reclaim(int xvncId)
+{
+    return reclaimIf([xvncId](const ParkedFeed &parkedFeed) {
+        return parkedFeed.feed->xvnc()->id() == xvncId;
+    });
+}
+
+void SessionFeedManager::share(const std::shared_ptr<SessionFeed> &feed)
+{
+    if (!m_fanOut) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    m_sharedFeeds.erase(std::remove_if(m_sharedFeeds.begin(), m_sharedFeeds.end(), [](const std::weak_ptr<SessionFeed> &sharedFeed) {
+        return sharedFeed.expired();
+    }), m_sharedFeeds.end());
+
+    m_sharedFeeds.push_back(feed);
+}
+
+std::shared_ptr<SessionFeed> SessionFeedManager::join(int xvncId, const std::vector<EncodingType> &cursorEncodings)
+{
+    if (!m_fanOut) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    for (const std::weak_ptr<SessionFeed> &sharedFeed : m_sharedFeeds) {
+        std::shared_ptr<SessionFeed> feed = sharedFeed.lock();
+        if (!feed || feed->xvnc()->id() != xvncId || !feed->alive() || feed->cursorEncodings() != cursorEncodings) {
+            continue;
+        }
+
+        // The feed may be waiting for reconnection of its previous client, now it has a new one.
+        m_parkedFeeds.remove_if([&feed](const ParkedFeed &parkedFeed) {
+            return parkedFeed.feed == feed;
+        });
+
+        m_joinedCount++;
+        return feed;
+    }
+
+    return nullptr;
+}
+
+template<typename Predicate>
+std::shared_ptr<SessionFeed> SessionFeedManager::reclaimIf(Predicate predicate)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    // Prefer the most recently disconnected client.
+    for (auto iter = m_parkedFeeds.rbegin(); iter != m_parkedFeeds.rend(); ++iter) {
+        if (predicate(*iter) && iter->feed->alive()) {
+            std::shared_ptr<SessionFeed> feed = iter->feed;
+            m_parkedFeeds.erase(std::next(iter).base());
+            m_reclaimedCount++;
+            return feed;
+        }
+    }
+
+    return nullptr;
+}
+
+void SessionFeedManager::logStatistics() const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    Log::info() << "Reconnect grace: " << m_parkedFeeds.size() << " connections kept, " << m_parkedCount << " total, " << m_reclaimedCount << " reclaimed, " << m_expiredCount << " expired" << std::endl;
+
+    if (m_fanOut) {
+        std::size_t liveCount = std::count_if(m_sharedFeeds.begin(), m_sharedFeeds.end(), [](const std::weak_ptr<SessionFeed> &sharedFeed) {
+            return !sharedFeed.expired();
+        });
+
+        Log::info() << "Fan-out: " << liveCount << " shared connections, " << m_joinedCount << " clients joined" << std::endl;
+    }
+}
+
+void SessionFeedManager::expire()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (!m_stopping) {
+        if (m_parkedFeeds.empty()) {
+            m_condition.wait(lock);
+            continue;
+        }
+
+        if (Clock::now() < m_parkedFeeds.front().deadline) {
+            m_condition.wait_until(lock, m_parkedFeeds.front().deadline);
+            continue;
+        }
+
+        std::shared_ptr<SessionFeed> feed = m_parkedFeeds.front().feed;
+        m_parkedFeeds.pop_front();
+        m_expiredCount++;
+
+        // Closing the connection waits for the thread of the feed, don't block others meanwhile.
+        lock.unlock();
+        Log::debug() << "Grace period for Xvnc #" << feed->xvnc()->id() << " expired." << std::endl;
+        feed.reset();
+        lock.lock();
+    }
+
+    m_parkedFeeds.clear();
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef SESSIONFEEDMANAGER_H
+#define SESSIONFEEDMANAGER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SessionFeed.h"
+
+
+/**
+ * @brief a class that shares session feeds between clients.
+ *
+ * It keeps session feeds of disconnected clients running for a grace period.
+ * A client that reconnects within the grace period is attached to its previous feed, so it skips the handshake with Xvnc and gets the current screen from the shadow framebuffer immediately.
+ * Clients are identified by their network address. Only feeds whose connection to Xvnc didn't need authentication are kept, so reconnecting never bypasses a password.
+ *
+ * In fan-out mode it also tracks live feeds, so all clients viewing the same session can be fed from a single connection to Xvnc.
+ * Feeds are grouped by the cursor encodings they ask Xvnc for, that is the only thing that differs in what Xvnc sends to them. Pixel format and encodings are translated for each client by its VncTunnel.
+ *
+ * @remark This class is thread-safe.
+ */
+class SessionFeedManager
+{
+private:
+    typedef std::chrono::steady_clock Clock;
+
+public:
+    SessionFeedManager();
+
+    SessionFeedManager(const SessionFeedManager &) = delete;
+    SessionFeedManager &operator=(const SessionFeedManager &) = delete;
+
+    ~SessionFeedManager();
+
+    /**
+     * Keep the feed running for the grace period after the client from given address disconnected.
+     * Does nothing if the grace period is disabled or the feed can not be kept.
+     */
+    void park(std::shared_ptr<SessionFeed> feed, const std::string &clientAddress);
+
+    /**
+     * Take the feed kept for given client address. Returns nullptr if there is none.
+     */
+    std::shared_ptr<SessionFeed> reclaim(const std::string &clientAddress);
+
+    /**
+     * Take the feed kept for given Xvnc. Returns nullptr if there is none.
+     */
+    std::shared_ptr<SessionFeed> reclaim(int xvncId);
+
+    /**
+     * Offer the feed to other clients that open the same session. Does nothing unless fan-out is enabled.
+     */
+    void share(const std::shared_ptr<SessionFeed> &feed);
+
+    /**
+     * Find live shared feed of given Xvnc that uses the same cursor encodings. Returns nullptr if there is none.
+     *
+     * The caller must have already verified that the client may access the session.
+     */
+    std::shared_ptr<SessionFeed> join(int xvncId, const std::vector<EncodingType> &cursorEncodings);
+
+    /**
+     * Write number of kept, reclaimed and expired feeds to the log.
+     */
+    void logStatistics() const;
+
+private:
+    void expire();
+
+    template<typename Predicate>
+    std::shared_ptr<SessionFeed> reclaimIf(Predicate predicate);
+
+private:
+    struct ParkedFeed {
+        std::shared_ptr<SessionFeed> feed;
+        std::string clientAddress;
+        Clock::time_point deadline;
+    };
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_condition;
+
+    Clock::duration m_gracePeriod;
+
+    std::list<ParkedFeed> m_parkedFeeds; // Ordered by deadline.
+
+    unsigned long m_parkedCount = 0;
+    unsigned long m_reclaimedCount = 0;
+    unsigned long m_expiredCount = 0;
+
+    bool m_fanOut;
+    std::vector<std::weak_ptr<SessionFeed>> m_sharedFeeds;
+    unsigned long m_joinedCount = 0;
+
+    bool m_stopping = false;
+    std::thread m_thread;
+};
+
+#endif // SESSIONFEEDMANAGER_H
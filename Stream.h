@@ -61,6 +61,13 @@ public:
      */
     virtual void recv(void *buf, std::size_t len) = 0;
 
+    /**
+     * @brief Hand over any data buffered by previous sends.
+     *
+     * Streams that send synchronously don't buffer anything and don't need to override this.
+     */
+    virtual void flush() {}
+
     /**
      * Read data from this stream to the buffer and write them to the output stream.
      *
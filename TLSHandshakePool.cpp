@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "helper.h"
+#include "Configuration.h"
+#include "Log.h"
+#include "TLSHandshakePool.h"
+
+
+constexpr int TLSHandshakePool::WorkerNiceness;
+
+
+static long milliseconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+}
+
+
+TLSHandshakePool::TLSHandshakePool()
+    : m_maxQueueLength(Configuration::options["tls-handshake-queue"].as<unsigned>())
+{
+    unsigned threads = Configuration::options["tls-handshake-threads"].as<unsigned>();
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned i = 0; i < threads; i++) {
+        m_workers.push_back(start_thread(&TLSHandshakePool::work, this));
+    }
+}
+
+TLSHandshakePool::~TLSHandshakePool()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+
+    for (auto &worker : m_workers) {
+        worker.join();
+    }
+}
+
+void TLSHandshakePool::run(Handshake handshake)
+{
+    std::future<void> result;
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        if (m_queue.size() >= m_maxQueueLength) {
+            m_statistics.rejected++;
+            throw std::runtime_error("Too many TLS handshakes waiting.");
+        }
+
+        Job job;
+        job.task = std::packaged_task<void(void)>(handshake);
+        job.enqueued = Clock::now();
+        result = job.task.get_future();
+
+        m_queue.push_back(std::move(job));
+    }
+    m_condition.notify_one();
+
+    result.get();
+}
+
+void TLSHandshakePool::logStatistics() const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    unsigned long count = std::max(1ul, m_statistics.count);
+
+    Log::info() << "TLS handshake pool: " << m_statistics.count << " handshakes, " << m_statistics.rejected << " rejected, " << m_queue.size() << " waiting"
+                << "; queue wait avg " << milliseconds(m_statistics.totalWait) / count << " ms, max " << milliseconds(m_statistics.maxWait) << " ms"
+                << "; duration avg " << milliseconds(m_statistics.totalDuration) / count << " ms, max " << milliseconds(m_statistics.maxDuration) << " ms" << std::endl;
+}
+
+void TLSHandshakePool::work()
+{
+    // Lower priority of this thread only. On Linux setpriority with thread id affects single thread.
+    if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), WorkerNiceness) < 0) {
+        Log::notice() << "Failed to lower priority of TLS handshake worker: " << strerror(errno) << std::endl;
+    }
+
+    while (true) {
+        Job job;
+
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_condition.wait(lock, [this]() {
+                return m_stopping || !m_queue.empty();
+            });
+
+            if (m_stopping) {
+                return;
+            }
+
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        Clock::time_point started = Clock::now();
+        job.task();
+        Clock::time_point finished = Clock::now();
+
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        Clock::duration wait = started - job.enqueued;
+        Clock::duration duration = finished - started;
+
+        m_statistics.count++;
+        m_statistics.totalWait += wait;
+        m_statistics.maxWait = std::max(m_statistics.maxWait, wait);
+        m_statistics.totalDuration += duration;
+        m_statistics.maxDuration = std::max(m_statistics.maxDuration, duration);
+    }
+}
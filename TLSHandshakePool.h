@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef TLSHANDSHAKEPOOL_H
+#define TLSHANDSHAKEPOOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * @brief a pool of worker threads that perform TLS handshakes.
+ *
+ * Handshakes are expensive and a storm of reconnecting clients could otherwise starve tunnels that are already forwarding frames.
+ * The pool runs at most configured number of handshakes at once with lowered scheduling priority. Waiting handshakes are queued and served in order of arrival.
+ *
+ * @remark This class is thread-safe.
+ */
+class TLSHandshakePool
+{
+public:
+    typedef std::function<void(void)> Handshake;
+
+    /**
+     * Niceness added to the worker threads, so they yield CPU to tunnels.
+     */
+    static constexpr int WorkerNiceness = 10;
+
+public:
+    TLSHandshakePool();
+
+    TLSHandshakePool(const TLSHandshakePool &) = delete;
+    TLSHandshakePool &operator=(const TLSHandshakePool &) = delete;
+
+    ~TLSHandshakePool();
+
+    /**
+     * @brief Run the handshake in one of the workers and wait for it to finish.
+     *
+     * Exceptions thrown by the handshake are rethrown in the calling thread.
+     * Throws std::runtime_error without running the handshake if the queue is full.
+     */
+    void run(Handshake handshake);
+
+    /**
+     * Write queue wait and handshake duration statistics to the log.
+     */
+    void logStatistics() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job {
+        std::packaged_task<void(void)> task;
+        Clock::time_point enqueued;
+    };
+
+    struct Statistics {
+        unsigned long count = 0;
+        unsigned long rejected = 0;
+        Clock::duration totalWait = Clock::duration::zero();
+        Clock::duration maxWait = Clock::duration::zero();
+        Clock::duration totalDuration = Clock::duration::zero();
+        Clock::duration maxDuration = Clock::duration::zero();
+    };
+
+    void work();
+
+private:
+    mutable std::mutex m_lock;
+    std::condition_variable m_condition;
+
+    std::size_t m_maxQueueLength;
+
+    std::deque<Job> m_queue;
+    std::vector<std::thread> m_workers;
+    bool m_stopping = false;
+
+    Statistics m_statistics;
+};
+
+#endif // TLSHANDSHAKEPOOL_H
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <time.h>
+
+#include <fstream>
+#include <iterator>
+
+#include <gnutls/crypto.h>
+
+#include "Configuration.h"
+#include "Log.h"
+#include "TLSSessionTickets.h"
+
+
+constexpr std::size_t TLSSessionTickets::KeySize;
+
+static constexpr std::size_t minimalSecretSize = 32;
+static constexpr char keyDerivationLabel[] = "vncmanager session ticket key";
+
+
+TLSSessionTickets::TLSSessionTickets()
+    : m_enabled(Configuration::options["tls-session-tickets"].as<bool>())
+    , m_rotationPeriod(Configuration::options["tls-ticket-key-rotation"].as<unsigned>())
+{
+    if (!m_enabled) {
+        return;
+    }
+
+    if (m_rotationPeriod <= 0) {
+        throw std::runtime_error("Rotation period of TLS session ticket keys must be positive.");
+    }
+
+    if (Configuration::options.count("tls-ticket-key-file") > 0) {
+        loadSecret(Configuration::options["tls-ticket-key-file"].as<std::string>());
+    } else {
+        m_secret.resize(KeySize);
+        if (gnutls_rnd(GNUTLS_RND_KEY, m_secret.data(), m_secret.size()) < 0) {
+            throw std::runtime_error("Failed to generate secret for TLS session tickets.");
+        }
+    }
+}
+
+void TLSSessionTickets::enable(gnutls_session_t session, std::vector<uint8_t> &key)
+{
+    if (!m_enabled) {
+        return;
+    }
+
+    key = currentKey();
+
+    const gnutls_datum_t datum = { key.data(), (unsigned int)key.size() };
+
+    int err;
+    if ((err = gnutls_session_ticket_enable_server(session, &datum)) != GNUTLS_E_SUCCESS) {
+        Log::warning() << "Failed to enable TLS session tickets: " << gnutls_strerror(err) << std::endl;
+    }
+}
+
+void TLSSessionTickets::recordHandshake(gnutls_session_t session)
+{
+    m_handshakes++;
+
+    if (gnutls_session_is_resumed(session)) {
+        m_resumedHandshakes++;
+        Log::debug() << "TLS session resumed." << std::endl;
+    }
+}
+
+void TLSSessionTickets::logStatistics() const
+{
+    unsigned long handshakes = m_handshakes;
+    unsigned long resumed = m_resumedHandshakes;
+
+    unsigned long hitRate = (handshakes > 0) ? resumed * 100 / handshakes : 0;
+
+    Log::info() << "TLS handshakes: " << handshakes << ", resumed: " << resumed << " (" << hitRate << "%)" << std::endl;
+}
+
+void TLSSessionTickets::loadSecret(const std::string &filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.good()) {
+        throw std::runtime_error("Failed to read TLS ticket key file " + filename);
+    }
+
+    m_secret.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    if (m_secret.size() < minimalSecretSize) {
+        throw std::runtime_error("TLS ticket key file " + filename + " must contain at least " + std::to_string(minimalSecretSize) + " bytes.");
+    }
+}
+
+std::vector<uint8_t> TLSSessionTickets::currentKey()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    long period = time(nullptr) / m_rotationPeriod;
+    if (period == m_keyPeriod) {
+        return m_key;
+    }
+
+    // Key for the period is HMAC of the label and the period number keyed by the secret. Every instance with the same secret derives the same key.
+    std::string message = std::string(keyDerivationLabel) + " " + std::to_string(period);
+
+    m_key.resize(KeySize); // Output of SHA-512 is exactly the size gnutls wants for ticket key.
+    int err;
+    if ((err = gnutls_hmac_fast(GNUTLS_MAC_SHA512, m_secret.data(), m_secret.size(), message.data(), message.size(), m_key.data())) < 0) {
+        throw std::runtime_error(std::string("Failed to derive TLS session ticket key: ") + gnutls_strerror(err));
+    }
+
+    if (m_keyPeriod != -1) {
+        Log::debug() << "Rotated TLS session ticket key." << std::endl;
+        logStatistics();
+    }
+
+    m_keyPeriod = period;
+
+    return m_key;
+}
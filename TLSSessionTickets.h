@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef TLSSESSIONTICKETS_H
+#define TLSSESSIONTICKETS_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <gnutls/gnutls.h>
+
+
+/**
+ * @brief a class that provides TLS session ticket keys and keeps resumption statistics.
+ *
+ * The ticket keys are derived from a secret and the current rotation period, so they change on a schedule without any timer.
+ * The secret is either generated randomly at start or read from a shared key file. Instances of vncmanager that use the same key file derive the same keys and can resume each other's sessions.
+ *
+ * @remark This class is thread-safe.
+ */
+class TLSSessionTickets
+{
+public:
+    /**
+     * Key size required by gnutls_session_ticket_enable_server.
+     */
+    static constexpr std::size_t KeySize = 64;
+
+public:
+    TLSSessionTickets();
+
+    TLSSessionTickets(const TLSSessionTickets &) = delete;
+    TLSSessionTickets &operator=(const TLSSessionTickets &) = delete;
+
+    /**
+     * Whether session tickets are enabled in configuration.
+     */
+    bool enabled() const { return m_enabled; }
+
+    /**
+     * Enable session tickets on given server session using the key for the current rotation period.
+     *
+     * @param session Initialized gnutls server session.
+     * @param key Storage for the key. It must stay valid for the whole life of the session.
+     */
+    void enable(gnutls_session_t session, std::vector<uint8_t> &key);
+
+    /**
+     * Record result of finished handshake.
+     */
+    void recordHandshake(gnutls_session_t session);
+
+    /**
+     * Write resumption hit rate to the log.
+     */
+    void logStatistics() const;
+
+private:
+    void loadSecret(const std::string &filename);
+    std::vector<uint8_t> currentKey();
+
+private:
+    std::mutex m_lock;
+
+    bool m_enabled;
+    long m_rotationPeriod;
+
+    std::vector<uint8_t> m_secret;
+
+    long m_keyPeriod = -1;
+    std::vector<uint8_t> m_key;
+
+    std::atomic<unsigned long> m_handshakes { 0 };
+    std::atomic<unsigned long> m_resumedHandshakes { 0 };
+};
+
+#endif // TLSSESSIONTICKETS_H
@@ -27,18 +27,25 @@
 #include <assert.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <string>
 
 #include "Configuration.h"
+#include "Log.h"
 #include "TLSStream.h"
 
 
-TLSStream::TLSStream(int fd, bool anonymous)
-    : m_fd(fd), m_anonymous(anonymous)
+constexpr std::size_t TLSStream::BatchSize;
+
+
+TLSStream::TLSStream(int fd, bool anonymous, TLSSessionTickets &sessionTickets)
+    : m_fd(fd), m_anonymous(anonymous), m_sessionTickets(sessionTickets)
 {}
 
 TLSStream::~TLSStream()
 {
+    stopEncryptionThread();
+
     if (m_tls.session) {
         gnutls_bye(m_tls.session, GNUTLS_SHUT_WR);
     }
@@ -126,6 +133,10 @@ void TLSStream::initialize()
         }
     }
 
+    m_sessionTickets.enable(m_tls.session, m_sessionTicketKey);
+
+    gnutls_handshake_set_timeout(m_tls.session, Configuration::options["tls-handshake-timeout"].as<unsigned>() * 1000);
+
     gnutls_transport_set_int(m_tls.session, fd());
 
     while (true) {
@@ -138,10 +149,19 @@ void TLSStream::initialize()
         }
         break;
     }
+
+    m_sessionTickets.recordHandshake(m_tls.session);
+
+    if (Configuration::options["tls-encryption-thread"].as<bool>()) {
+        startEncryptionThread();
+    }
 }
 
 void TLSStream::recv(void *buf, std::size_t len)
 {
+    // The other side may be waiting for what we sent before it answers.
+    flush();
+
     char *ptr = (char *)buf;
     while (len > 0) {
         ssize_t ret = gnutls_record_recv(m_tls.session, ptr, len);
@@ -164,6 +184,28 @@ void TLSStream::recv(void *buf, std::size_t len)
 }
 
 void TLSStream::send(const void *buf, std::size_t len)
+{
+    if (!m_pipeline.enabled) {
+        sendEncrypted(buf, len);
+        return;
+    }
+
+    const uint8_t *ptr = (const uint8_t *)buf;
+    m_pipeline.batch.insert(m_pipeline.batch.end(), ptr, ptr + len);
+
+    if (m_pipeline.batch.size() >= BatchSize) {
+        queueBatch();
+    }
+}
+
+void TLSStream::flush()
+{
+    if (m_pipeline.enabled && !m_pipeline.batch.empty()) {
+        queueBatch();
+    }
+}
+
+void TLSStream::sendEncrypted(const void *buf, std::size_t len)
 {
     const char *ptr = (const char *)buf;
     while (len > 0) {
@@ -180,6 +222,104 @@ void TLSStream::send(const void *buf, std::size_t len)
     }
 }
 
+void TLSStream::startEncryptionThread()
+{
+    m_pipeline.maxQueueLength = std::max(1u, Configuration::options["tls-encryption-queue"].as<unsigned>());
+    m_pipeline.batch.reserve(BatchSize);
+    m_pipeline.enabled = true;
+    m_pipeline.thread = std::thread(&TLSStream::encrypt, this);
+}
+
+void TLSStream::stopEncryptionThread()
+{
+    if (!m_pipeline.enabled) {
+        return;
+    }
+
+    try {
+        flush();
+    } catch (std::exception &e) {
+        // The encryption thread already failed, nothing more will be sent.
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_pipeline.lock);
+        m_pipeline.stopping = true;
+    }
+    m_pipeline.condition.notify_all();
+
+    m_pipeline.thread.join();
+    m_pipeline.enabled = false;
+
+    auto milliseconds = [](Clock::duration duration) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    };
+
+    long encryptionTime = milliseconds(m_pipeline.encryptionTime);
+    Log::debug() << "TLS encryption thread sent " << m_pipeline.encryptedBytes << " bytes in " << encryptionTime << " ms"
+                 << " (" << (encryptionTime > 0 ? m_pipeline.encryptedBytes / 1000 / encryptionTime : 0) << " MB/s)"
+                 << ", sending thread waited " << milliseconds(m_pipeline.blockedTime) << " ms for free queue." << std::endl;
+}
+
+void TLSStream::queueBatch()
+{
+    std::unique_lock<std::mutex> lock(m_pipeline.lock);
+
+    if (m_pipeline.queue.size() >= m_pipeline.maxQueueLength) {
+        Clock::time_point blockedSince = Clock::now();
+        m_pipeline.condition.wait(lock, [this]() {
+            return m_pipeline.queue.size() < m_pipeline.maxQueueLength || m_pipeline.error;
+        });
+        m_pipeline.blockedTime += Clock::now() - blockedSince;
+    }
+
+    if (m_pipeline.error) {
+        std::rethrow_exception(m_pipeline.error);
+    }
+
+    m_pipeline.queue.push_back(std::move(m_pipeline.batch));
+    lock.unlock();
+    m_pipeline.condition.notify_all();
+
+    m_pipeline.batch = std::vector<uint8_t>();
+    m_pipeline.batch.reserve(BatchSize);
+}
+
+void TLSStream::encrypt()
+{
+    while (true) {
+        std::vector<uint8_t> batch;
+
+        {
+            std::unique_lock<std::mutex> lock(m_pipeline.lock);
+            m_pipeline.condition.wait(lock, [this]() {
+                return m_pipeline.stopping || !m_pipeline.queue.empty();
+            });
+
+            if (m_pipeline.queue.empty()) {
+                return; // Stopping and everything was sent
+            }
+
+            batch = std::move(m_pipeline.queue.front());
+            m_pipeline.queue.pop_front();
+        }
+        m_pipeline.condition.notify_all();
+
+        try {
+            Clock::time_point started = Clock::now();
+            sendEncrypted(batch.data(), batch.size());
+            m_pipeline.encryptionTime += Clock::now() - started;
+            m_pipeline.encryptedBytes += batch.size();
+        } catch (std::exception &e) {
+            std::lock_guard<std::mutex> guard(m_pipeline.lock);
+            m_pipeline.error = std::current_exception();
+            m_pipeline.queue.clear();
+            m_pipeline.condition.notify_all();
+            return;
+        }
+    }
+}
+
 int TLSStream::takeFd()
 {
     assert(!"Not supported."); // Taking fd from TLS stream shouldn't be needed, so it is not supported.
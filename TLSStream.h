@@ -29,13 +29,25 @@
 
 #include <gnutls/gnutls.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "FdStream.h"
 #include "Stream.h"
+#include "TLSSessionTickets.h"
 
 
 /**
  * @brief implementation of Stream with TLS encryption.
  *
+ * Optionally the encryption runs in a separate thread. Sent data are then collected into batches which are passed to the encryption thread through a bounded queue. The batches are handed over when they are full, when flush() is called or before receiving.
+ *
  * @remark This class is not thread-safe and requires external synchronization if shared between threads.
  */
 class TLSStream : public Stream
@@ -58,8 +70,9 @@ public:
      *
      * @param fd Opened file descriptor that can be read from and written to.
      * @param anonymous True for anonymous TLS, false for TLS with certificate.
+     * @param sessionTickets Provider of session ticket keys.
      */
-    TLSStream(int fd, bool anonymous);
+    TLSStream(int fd, bool anonymous, TLSSessionTickets &sessionTickets);
 
     TLSStream(TLSStream &) = delete;
     FdStream &operator=(FdStream &) = delete;
@@ -75,19 +88,57 @@ public:
 
     virtual void send(const void *buf, std::size_t len);
 
+    virtual void flush();
+
     virtual int fd() const { return m_fd; }
     virtual int takeFd();
 
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Size of batch that is handed over to the encryption thread without waiting for flush.
+     */
+    static constexpr std::size_t BatchSize = 64 * 1024;
+
+    void sendEncrypted(const void *buf, std::size_t len);
+
+    void startEncryptionThread();
+    void stopEncryptionThread();
+    void queueBatch();
+    void encrypt();
+
 private:
     int m_fd;
     bool m_anonymous;
 
+    TLSSessionTickets &m_sessionTickets;
+    std::vector<uint8_t> m_sessionTicketKey;
+
     struct {
         gnutls_session_t session = nullptr;
         gnutls_dh_params_t dh_params = nullptr;
         gnutls_anon_server_credentials_t anon_cred = nullptr;
         gnutls_certificate_credentials_t cert_cred = nullptr;
     } m_tls;
+
+    struct {
+        bool enabled = false;
+        std::size_t maxQueueLength;
+
+        std::thread thread;
+        std::mutex lock;
+        std::condition_variable condition;
+
+        std::vector<uint8_t> batch; // Owned by the sending thread, not protected by the lock.
+        std::deque<std::vector<uint8_t>> queue;
+        bool stopping = false;
+        std::exception_ptr error;
+
+        std::size_t encryptedBytes = 0;
+        Clock::duration encryptionTime = Clock::duration::zero();
+        Clock::duration blockedTime = Clock::duration::zero();
+    } m_pipeline;
 };
 
 #endif // TLSSTREAM_H
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <jpeglib.h>
+
+#include "Palette.h"
+#include "TightEncoder.h"
+
+
+constexpr int TightEncoder::CompressionLevel;
+constexpr int TightEncoder::MaxRectangleWidth;
+constexpr int TightEncoder::TileSize;
+
+
+namespace {
+
+struct JpegError {
+    jpeg_error_mgr manager;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+void jpegErrorExit(j_common_ptr info)
+{
+    JpegError *error = (JpegError *)info->err;
+    (*info->err->format_message)(info, error->message);
+    std::longjmp(error->jump, 1);
+}
+
+/**
+ * JPEG compressor owned by each encoding thread.
+ */
+struct JpegCompressor {
+    jpeg_compress_struct info;
+    JpegError error;
+    std::vector<uint8_t> rgb;
+
+    JpegCompressor() {
+        info.err = jpeg_std_error(&error.manager);
+        error.manager.error_exit = jpegErrorExit;
+        jpeg_create_compress(&info);
+    }
+
+    ~JpegCompressor() {
+        jpeg_destroy_compress(&info);
+    }
+};
+
+}
+
+
+TightEncoder::TightEncoder()
+{
+}
+
+void TightEncoder::setPixelFormat(const PixelFormat &pixelFormat)
+{
+    m_pixelFormat = pixelFormat;
+    m_bytesPerPixel = pixelFormat.bytesPerPixel();
+    m_rgbTightPixels = pixelFormat.bitsPerPixel == 32 && pixelFormat.depth == 24 && pixelFormat.redMax == 255 && pixelFormat.greenMax == 255 && pixelFormat.blueMax == 255;
+}
+
+int TightEncoder::jpegQuality(int qualityLevel)
+{
+    static const int qualities[] = { 15, 29, 41, 42, 62, 77, 79, 86, 92, 100 };
+    return qualities[std::max(0, std::min(9, qualityLevel))];
+}
+
+bool TightEncoder::isPhotographic(const uint8_t *pixels, std::size_t stride, int width, int height) const
+{
+    Palette palette;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = pixels + y * stride;
+        for (int x = 0; x < width; x++) {
+            if (!palette.insert(readPixel(row + x * m_bytesPerPixel))) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void TightEncoder::encodeJpeg(const Rect &rect, const uint8_t *pixels, std::size_t stride, int quality, std::vector<uint8_t> &output) const
+{
+    static thread_local JpegCompressor compressor;
+
+    // JPEG is compressed from RGB, the client converts the decoded pixels back to its format.
+    std::vector<uint8_t> &rgb = compressor.rgb;
+    rgb.resize(rect.width * rect.height * 3);
+
+    uint8_t *dst = rgb.data();
+    for (int y = 0; y < rect.height; y++) {
+        const uint8_t *row = pixels + y * stride;
+        for (int x = 0; x < rect.width; x++) {
+            uint32_t pixel = readPixel(row + x * m_bytesPerPixel);
+            *dst++ = ((pixel >> m_pixelFormat.redShift) & m_pixelFormat.redMax) * 255 / m_pixelFormat.redMax;
+            *dst++ = ((pixel >> m_pixelFormat.greenShift) & m_pixelFormat.greenMax) * 255 / m_pixelFormat.greenMax;
+            *dst++ = ((pixel >> m_pixelFormat.blueShift) & m_pixelFormat.blueMax) * 255 / m_pixelFormat.blueMax;
+        }
+    }
+
+    jpeg_compress_struct &info = compressor.info;
+    unsigned char *buffer = nullptr;
+    unsigned long size = 0;
+
+    if (setjmp(compressor.error.jump)) {
+        jpeg_abort_compress(&info);
+        std::free(buffer);
+        throw std::runtime_error(std::string("Failed to compress JPEG: ") + compressor.error.message);
+    }
+
+    jpeg_mem_dest(&info, &buffer, &size);
+
+    info.image_width = rect.width;
+    info.image_height = rect.height;
+    info.input_components = 3;
+    info.in_color_space = JCS_RGB;
+
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, quality, TRUE);
+    info.dct_method = JDCT_FASTEST;
+
+    // Chroma is subsampled less with higher quality, sharp coloured edges would blur otherwise.
+    info.comp_info[0].h_samp_factor = (quality >= 90) ? 1 : 2;
+    info.comp_info[0].v_samp_factor = (quality >= 75) ? 1 : 2;
+
+    jpeg_start_compress(&info, TRUE);
+    while (info.next_scanline < info.image_height) {
+        JSAMPROW row = &rgb[info.next_scanline * rect.width * 3];
+        jpeg_write_scanlines(&info, &row, 1);
+    }
+    jpeg_finish_compress(&info);
+
+    writeHeader(rect, output);
+    output.push_back(0x90); // JPEG compression
+    writeCompactLength(size, output);
+    output.insert(output.end(), buffer, buffer + size);
+
+    std::free(buffer);
+}
+
+void TightEncoder::encodeLossless(const Rect &rect, const uint8_t *pixels, std::size_t stride, std::vector<uint8_t> &output, std::vector<DeflateStreams::Chunk> &chunks) const
+{
+    static thread_local std::vector<uint8_t> data;
+
+    Palette palette;
+    bool paletteOverflow = false;
+
+    for (int y = 0; y < rect.height && !paletteOverflow; y++) {
+        const uint8_t *row = pixels + y * stride;
+        for (int x = 0; x < rect.width; x++) {
+            if (!palette.insert(readPixel(row + x * m_bytesPerPixel))) {
+                paletteOverflow = true;
+                break;
+            }
+        }
+    }
+
+    writeHeader(rect, output);
+
+    if (!paletteOverflow && palette.size() == 1) {
+        output.push_back(0x80); // Fill compression
+        writeTightPixel(palette.colour(0), output);
+        return;
+    }
+
+    data.clear();
+
+    if (!paletteOverflow) {
+        // Two colours are sent as bitmap, more as one byte indexes.
+        bool bitmap = palette.size() == 2;
+        int stream = bitmap ? 1 : 2;
+
+        output.push_back((stream << 4) | 0x40); // Basic compression with explicit filter
+        output.push_back((uint8_t)TightFilter::Palette);
+        output.push_back(palette.size() - 1);
+        for (std::size_t i = 0; i < palette.size(); i++) {
+            writeTightPixel(palette.colour(i), output);
+        }
+
+        for (int y = 0; y < rect.height; y++) {
+            const uint8_t *row = pixels + y * stride;
+
+            if (bitmap) {
+                uint8_t byte = 0;
+                int usedBits = 0;
+                for (int x = 0; x < rect.width; x++) {
+                    byte = (byte << 1) | palette.index(readPixel(row + x * m_bytesPerPixel));
+                    if (++usedBits == 8) {
+                        data.push_back(byte);
+                        byte = 0;
+                        usedBits = 0;
+                    }
+                }
+
+                if (usedBits > 0) {
+                    data.push_back(byte << (8 - usedBits));
+                }
+            } else {
+                for (int x = 0; x < rect.width; x++) {
+                    data.push_back(palette.index(readPixel(row + x * m_bytesPerPixel)));
+                }
+            }
+        }
+
+        writeData(stream, data, output, chunks);
+        return;
+    }
+
+    output.push_back(0x00); // Basic compression, stream 0, copy filter
+    for (int y = 0; y < rect.height; y++) {
+        const uint8_t *row = pixels + y * stride;
+        for (int x = 0; x < rect.width; x++) {
+            writeTightPixel(readPixel(row + x * m_bytesPerPixel), data);
+        }
+    }
+
+    writeData(0, data, output, chunks);
+}
+
+void TightEncoder::writeHeader(const Rect &rect, std::vector<uint8_t> &output) const
+{
+    FramebufferUpdateRectangle rectangle;
+    rectangle.xPosition = rect.x;
+    rectangle.yPosition = rect.y;
+    rectangle.width = rect.width;
+    rectangle.height = rect.height;
+    rectangle.encodingType = EncodingType::Tight;
+    rectangle.hton();
+
+    const uint8_t *header = (const uint8_t *)&rectangle;
+    output.insert(output.end(), header, header + sizeof(rectangle));
+}
+
+void TightEncoder::writeData(int stream, const std::vector<uint8_t> &data, std::vector<uint8_t> &output, std::vector<DeflateStreams::Chunk> &chunks) const
+{
+    if (data.size() < TightMinSizeToCompress) {
+        output.insert(output.end(), data.begin(), data.end());
+        return;
+    }
+
+    static thread_local std::vector<uint8_t> compressed;
+    compressed.clear();
+    DeflateStreams::compress(data.data(), data.size(), CompressionLevel, compressed);
+
+    DeflateStreams::Chunk chunk;
+    chunk.lengthOffset = output.size();
+    chunk.encoding = EncodingType::Tight;
+    chunk.stream = stream;
+    chunks.push_back(chunk);
+
+    DeflateStreams::writeCompactLength(compressed.size(), output);
+    output.insert(output.end(), compressed.begin(), compressed.end());
+}
+
+uint32_t TightEncoder::readPixel(const uint8_t *src) const
+{
+    switch (m_bytesPerPixel) {
+    case 1:
+        return src[0];
+    case 2:
+        return m_pixelFormat.bigEndianFlag ? (src[0] << 8) | src[1] : (src[1] << 8) | src[0];
+    default:
+        return m_pixelFormat.bigEndianFlag ? ((uint32_t)src[0] << 24) | (src[1] << 16) | (src[2] << 8) | src[3] : ((uint32_t)src[3] << 24) | (src[2] << 16) | (src[1] << 8) | src[0];
+    }
+}
+
+void TightEncoder::writeTightPixel(uint32_t pixel, std::vector<uint8_t> &output) const
+{
+    if (m_rgbTightPixels) {
+        output.push_back(pixel >> m_pixelFormat.redShift);
+        output.push_back(pixel >> m_pixelFormat.greenShift);
+        output.push_back(pixel >> m_pixelFormat.blueShift);
+        return;
+    }
+
+    for (int i = 0; i < m_bytesPerPixel; i++) {
+        int shift = m_pixelFormat.bigEndianFlag ? (m_bytesPerPixel - 1 - i) * 8 : i * 8;
+        output.push_back(pixel >> shift);
+    }
+}
+
+void TightEncoder::writeCompactLength(std::size_t length, std::vector<uint8_t> &output)
+{
+    if (length < 0x80) {
+        output.push_back(length);
+    } else if (length < 0x4000) {
+        output.push_back((length & 0x7f) | 0x80);
+        output.push_back(length >> 7);
+    } else {
+        DeflateStreams::writeCompactLength(length, output);
+    }
+}
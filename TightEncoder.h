@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef TIGHTENCODER_H
+#define TIGHTENCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rfb.h"
+#include "DeflateStreams.h"
+#include "Region.h"
+
+
+/**
+ * @brief a class that encodes pixels into Tight rectangles.
+ *
+ * Photographic content can be sent as JPEG, everything else is sent losslessly as solid fill, palette or full colour data compressed by zlib.
+ * Zlib data are compressed independently for each rectangle, see DeflateStreams.
+ *
+ * @remark Methods encoding pixels can be called from multiple threads at once. Changing the pixel format requires external synchronization.
+ */
+class TightEncoder
+{
+public:
+    static constexpr int CompressionLevel = 6;
+
+    /**
+     * Widest rectangle that the Tight decoders accept.
+     */
+    static constexpr int MaxRectangleWidth = 2048;
+
+    /**
+     * Size of tiles that are classified as photographic or not.
+     */
+    static constexpr int TileSize = 64;
+
+public:
+    TightEncoder();
+
+    /**
+     * Set pixel format of the pixels given to the encoding methods. It must be true colour.
+     */
+    void setPixelFormat(const PixelFormat &pixelFormat);
+
+    /**
+     * Convert quality level 0-9 from JpegQuality pseudo-encoding to JPEG quality.
+     */
+    static int jpegQuality(int qualityLevel);
+
+    /**
+     * @brief Decide whether the area looks like a photo or video rather than text and user interface.
+     *
+     * Areas with more colours than fit in palette are considered photographic.
+     */
+    bool isPhotographic(const uint8_t *pixels, std::size_t stride, int width, int height) const;
+
+    /**
+     * @brief Encode the rectangle as JPEG and append it including its header to output.
+     *
+     * @param rect Position of the rectangle in framebuffer.
+     * @param pixels Pixels of the rectangle in the pixel format set by setPixelFormat().
+     * @param stride Distance between rows of pixels in bytes.
+     * @param quality JPEG quality 1-100.
+     * @param output Buffer where the rectangle is appended.
+     */
+    void encodeJpeg(const Rect &rect, const uint8_t *pixels, std::size_t stride, int quality, std::vector<uint8_t> &output) const;
+
+    /**
+     * @brief Encode the rectangle losslessly and append it including its header to output.
+     *
+     * @param rect Position of the rectangle in framebuffer. Must not be wider than MaxRectangleWidth.
+     * @param pixels Pixels of the rectangle in the pixel format set by setPixelFormat().
+     * @param stride Distance between rows of pixels in bytes.
+     * @param output Buffer where the rectangle is appended.
+     * @param chunks Compressed chunks are recorded here, they have to be passed to DeflateStreams::start() before sending.
+     */
+    void encodeLossless(const Rect &rect, const uint8_t *pixels, std::size_t stride, std::vector<uint8_t> &output, std::vector<DeflateStreams::Chunk> &chunks) const;
+
+private:
+    void writeHeader(const Rect &rect, std::vector<uint8_t> &output) const;
+    void writeData(int stream, const std::vector<uint8_t> &data, std::vector<uint8_t> &output, std::vector<DeflateStreams::Chunk> &chunks) const;
+
+    uint32_t readPixel(const uint8_t *src) const;
+    void writeTightPixel(uint32_t pixel, std::vector<uint8_t> &output) const;
+
+    static void writeCompactLength(std::size_t length, std::vector<uint8_t> &output);
+
+private:
+    PixelFormat m_pixelFormat;
+    int m_bytesPerPixel = 4;
+
+    // Tight sends 24 bit colour pixels as three bytes in RGB order.
+    bool m_rgbTightPixels = false;
+};
+
+#endif // TIGHTENCODER_H
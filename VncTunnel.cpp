@@ -37,17 +37,73 @@
 #include "Log.h"
 
 
-VncTunnel::VncTunnel(XvncManager &xvncManager, GreeterManager &greeterManager, ControllerManager &controllerManager, int fd)
+static std::string peerAddress(int fd)
+{
+    sockaddr_storage address;
+    socklen_t addressLength = sizeof(address);
+    if (getpeername(fd, (sockaddr *)&address, &addressLength) < 0) {
+        return std::string();
+    }
+
+    char text[INET6_ADDRSTRLEN] = "";
+    if (address.ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((sockaddr_in *)&address)->sin_addr, text, sizeof(text));
+    } else if (address.ss_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((sockaddr_in6 *)&address)->sin6_addr, text, sizeof(text));
+    }
+
+    return text;
+}
+
+
+/**
+ * Split rectangles into horizontal bands of at most given height.
+ */
+static std::vector<Rect> splitIntoBands(const std::vector<Rect> &rects, int height)
+{
+    std::vector<Rect> bands;
+    for (const Rect &rect : rects) {
+        for (int y = 0; y < rect.height; y += height) {
+            bands.push_back(Rect(rect.x, rect.y + y, rect.width, std::min(height, rect.height - y)));
+        }
+    }
+    return bands;
+}
+
+
+constexpr int VncTunnel::BandHeight;
+
+
+VncTunnel::VncTunnel(XvncManager &xvncManager, GreeterManager &greeterManager, ControllerManager &controllerManager, TLSSessionTickets &tlsSessionTickets, TLSHandshakePool &tlsHandshakePool, SessionFeedManager &sessionFeedManager, EncoderPool &encoderPool, int fd)
     : m_xvncManager(xvncManager)
     , m_greeterManager(greeterManager)
     , m_controllerManager(controllerManager)
+    , m_tlsSessionTickets(tlsSessionTickets)
+    , m_tlsHandshakePool(tlsHandshakePool)
+    , m_sessionFeedManager(sessionFeedManager)
+    , m_encoderPool(encoderPool)
     , m_stream(new FdStream(fd))
     , m_streamFormatter(m_stream)
+    , m_clientAddress(peerAddress(fd))
+    , m_shadowFramebuffer(Configuration::options["shadow-framebuffer"].as<bool>())
+    , m_translatePixels(Configuration::options["translate-pixels"].as<bool>())
 {
+    if (m_shadowFramebuffer && Configuration::options["adaptive-colour-depth"].as<bool>()) {
+        m_colourDepthPolicy.reset(new ColourDepthPolicy(fd));
+    }
 }
 
 VncTunnel::~VncTunnel()
 {
+    if (m_feed) {
+        m_feed->unsubscribe(m_feedSubscriber);
+
+        // Sessions that are still being chosen in greeter are not worth keeping.
+        if (!m_greeterConnection && !m_clientAddress.empty()) {
+            m_sessionFeedManager.park(m_feed, m_clientAddress);
+        }
+    }
+
     if (m_greeterConnection) {
         m_greeterManager.releaseGreeter(m_greeterConnection);
     }
@@ -63,23 +119,43 @@ void VncTunnel::start()
     Log::info() << "Accepted client " << (intptr_t)this << "." << std::endl;
 
     try {
-        // Create new session
-        bool showGreeter = !Configuration::options["disable-manager"].as<bool>() && (Configuration::options["always-show-greeter"].as<bool>() || m_xvncManager.hasVisibleSessions());
-
-        if (showGreeter) {
-            m_tightEncodingDisabled = true;
+        // Reconnecting client continues in its previous session if it was kept for it
+        std::shared_ptr<SessionFeed> keptFeed;
+        if (m_shadowFramebuffer) {
+            keptFeed = m_sessionFeedManager.reclaim(m_clientAddress);
         }
 
-        auto xvnc = m_xvncManager.createSession(!showGreeter);
+        if (keptFeed) {
+            Log::info() << "Client " << (intptr_t)this << " reconnected to Xvnc #" << keptFeed->xvnc()->id() << "." << std::endl;
 
-        if (showGreeter) {
-            m_greeterConnection = m_greeterManager.createGreeter(xvnc->display(), xvnc->xauthFilename(), std::bind(&VncTunnel::newSessionHandler, this), std::bind(&VncTunnel::openSessionHandler, this, std::placeholders::_1));
-        }
+            attachFeed(keptFeed);
+        } else {
+            // Create new session
+            bool showGreeter = !Configuration::options["disable-manager"].as<bool>() && (Configuration::options["always-show-greeter"].as<bool>() || m_xvncManager.hasVisibleSessions());
+
+            if (showGreeter) {
+                m_zlibEncodingsDisabled = true;
+            }
+
+            auto xvnc = m_xvncManager.createSession(!showGreeter);
+
+            if (showGreeter) {
+                m_greeterConnection = m_greeterManager.createGreeter(xvnc->display(), xvnc->xauthFilename(), std::bind(&VncTunnel::newSessionHandler, this), std::bind(&VncTunnel::openSessionHandler, this, std::placeholders::_1));
+            }
 
-        m_currentConnection = new XvncConnection(xvnc);
-        m_currentConnection->initialize();
+            m_currentConnection = new XvncConnection(xvnc);
+            m_currentConnection->initialize();
 
-        m_pixelFormat = m_currentConnection->pixelFormat();
+            if (m_shadowFramebuffer) {
+                // The feed takes over the connection
+                attachFeed(std::make_shared<SessionFeed>(std::unique_ptr<XvncConnection>(m_currentConnection), cursorEncodings()));
+                m_currentConnection = nullptr;
+
+                m_sessionFeedManager.share(m_feed);
+            }
+        }
+
+        m_pixelFormat = m_feed ? m_feed->framebuffer().pixelFormat() : m_currentConnection->pixelFormat();
 
         clientInitalize();
 
@@ -221,12 +297,13 @@ void VncTunnel::handleVeNCryptSecurity()
     case VeNCryptSubtype::X509None: {
         // Convert the client stream into TLSStream
         bool anonymousTLS = (selectedSubtype == VeNCryptSubtype::TLSNone);
-        TLSStream *newTLSStream = new TLSStream(m_stream->takeFd(), anonymousTLS);
+        TLSStream *newTLSStream = new TLSStream(m_stream->takeFd(), anonymousTLS, m_tlsSessionTickets);
         delete m_stream;
         m_stream = newTLSStream;
         m_streamFormatter = StreamFormatter(m_stream);
 
-        newTLSStream->initialize();
+        // Handshake runs in the shared pool which limits how many of them run at once
+        m_tlsHandshakePool.run(std::bind(&TLSStream::initialize, newTLSStream));
 
         // Proceed with handling None security
         handleNoneSecurity();
@@ -255,24 +332,43 @@ void VncTunnel::finishClientInitialization()
 
     // Send ServerInit message
     ServerInitMessage serverInit;
-    serverInit.framebufferWidth = m_currentConnection->framebufferWidth();
-    serverInit.framebufferHeight = m_currentConnection->framebufferHeight();
-    serverInit.serverPixelFormat = m_currentConnection->pixelFormat();
-    serverInit.nameLength = m_currentConnection->desktopName().length();
+    if (m_feed) {
+        Framebuffer &framebuffer = m_feed->framebuffer();
+        std::lock_guard<std::mutex> guard(framebuffer.mutex());
+
+        serverInit.framebufferWidth = framebuffer.width();
+        serverInit.framebufferHeight = framebuffer.height();
+        serverInit.serverPixelFormat = framebuffer.pixelFormat();
+    } else {
+        serverInit.framebufferWidth = m_currentConnection->framebufferWidth();
+        serverInit.framebufferHeight = m_currentConnection->framebufferHeight();
+        serverInit.serverPixelFormat = m_currentConnection->pixelFormat();
+    }
+    serverInit.nameLength = desktopName().length();
 
     cFmt().send(serverInit);
-    cFmt().send(m_currentConnection->desktopName());
+    cFmt().send(desktopName());
+
+    m_clientFramebufferWidth = serverInit.framebufferWidth;
+    m_clientFramebufferHeight = serverInit.framebufferHeight;
 }
 
 void VncTunnel::select()
 {
     m_selector.clear();
     m_selector.addStream(cStream(), std::bind(&VncTunnel::clientReceive, this));
-    m_selector.addStream(sStream(), std::bind(&VncTunnel::serverReceive, this));
+    if (m_feed) {
+        m_selector.addFD(m_feedSubscriber->fd(), std::bind(&VncTunnel::feedReceive, this));
+    } else {
+        m_selector.addStream(sStream(), std::bind(&VncTunnel::serverReceive, this));
+    }
     if (m_greeterConnection) {
         m_greeterConnection->prepareSelect(m_selector);
     }
 
+    // Whatever the client should get must be on its way before we start waiting.
+    cStream().flush();
+
     m_selector.select();
 }
 
@@ -314,6 +410,11 @@ void VncTunnel::clientReceive()
     default:
         throw std::runtime_error("Received unknown message type from vnc client");
     }
+
+    // Whole forwarded message must be handed over to a feed at once.
+    if (m_feed) {
+        sStream().flush();
+    }
 }
 
 void VncTunnel::processSetPixelFormat()
@@ -326,6 +427,31 @@ void VncTunnel::processSetPixelFormat()
 
     m_pixelFormat = message.pixelFormat;
 
+    if (m_feed) {
+        if (!m_pixelFormat.trueColourFlag) {
+            throw std::runtime_error("Colour map pixel formats are not supported with shadow framebuffer.");
+        }
+
+        // Xvnc keeps sending in the format of the shadow framebuffer, we convert for the client. The cursor has to be converted again.
+        m_cursorChangeQueued = !cursorEncodings().empty();
+        return;
+    }
+
+    if (m_translatePixels) {
+        // Xvnc keeps its native format if we can translate to the client's format. Encodings that can not be translated are requested only while the formats match.
+        std::vector<EncodingType> previousEncodings = m_supportedEncodingsServer;
+        updateSupportedEncodings();
+        if (m_supportedEncodingsServer != previousEncodings) {
+            m_currentConnection->sendSetEncodings(m_supportedEncodingsServer);
+        }
+
+        PixelFormat pixelFormat = serverPixelFormat();
+        if (m_currentConnection->pixelFormat() != pixelFormat) {
+            m_currentConnection->sendSetPixelFormat(pixelFormat);
+        }
+        return;
+    }
+
     m_currentConnection->sendSetPixelFormat(m_pixelFormat);
 }
 
@@ -334,17 +460,42 @@ void VncTunnel::processSetEncodings()
     SetEncodingsMessage message;
     cFmt().recv(message);
 
-    std::vector<EncodingType> encodings(message.numberOfEncodings);
-    cFmt().recv(encodings);
+    m_clientEncodings.resize(message.numberOfEncodings);
+    cFmt().recv(m_clientEncodings);
+
+    updateSupportedEncodings();
+
+    if (m_feed) {
+        if (m_feed->subscriberCount() > 1 && m_feed->cursorEncodings() != cursorEncodings()) {
+            // Changing what Xvnc sends would break the other clients. This client gets the cursor only if it supports the encoding the feed uses.
+            Log::debug() << "Client " << (intptr_t)this << " keeps cursor encodings of shared connection to Xvnc #" << m_feed->xvnc()->id() << "." << std::endl;
+        } else {
+            m_feed->setCursorEncodings(cursorEncodings());
+        }
+        m_cursorChangeQueued = !cursorEncodings().empty();
+        return;
+    }
+
+    m_currentConnection->sendSetEncodings(m_supportedEncodingsServer);
+}
 
+void VncTunnel::updateSupportedEncodings()
+{
     // Filter down only to encodings we support
     m_supportedEncodingsClient.clear();
     m_supportedEncodingsServer.clear();
-    for (EncodingType encoding : encodings) {
+    m_losslessEncoding = EncodingType::Raw;
+    m_jpegQualityLevel = -1;
+
+    // Compressed encodings can be forwarded only as they are, not translated to other pixel format.
+    bool forwardCompressed = !m_zlibEncodingsDisabled && serverPixelFormat() == m_pixelFormat;
+
+    for (EncodingType encoding : m_clientEncodings) {
         switch (encoding) {
         case EncodingType::Raw:
         case EncodingType::CopyRect:
         case EncodingType::RRE:
+        case EncodingType::Hextile:
         case EncodingType::DesktopSize:
         case EncodingType::LastRect:
         case EncodingType::Cursor:
@@ -355,9 +506,33 @@ void VncTunnel::processSetEncodings()
             m_supportedEncodingsServer.push_back(encoding);
             break;
 
+        case EncodingType::ZRLE:
+            m_supportedEncodingsClient.insert(encoding);
+            if (m_shadowFramebuffer) {
+                // Encoded by us from the shadow framebuffer, never forwarded.
+                if (m_losslessEncoding == EncodingType::Raw) {
+                    m_losslessEncoding = encoding;
+                }
+            } else if (forwardCompressed) {
+                m_supportedEncodingsServer.push_back(encoding);
+            }
+            break;
+
+        case EncodingType::Zlib:
+            if (!m_shadowFramebuffer) {
+                m_supportedEncodingsClient.insert(encoding);
+                if (forwardCompressed) {
+                    m_supportedEncodingsServer.push_back(encoding);
+                }
+            }
+            break;
+
         case EncodingType::Tight:
             m_supportedEncodingsClient.insert(encoding);
-            if (!m_tightEncodingDisabled) {
+            if (m_shadowFramebuffer && m_losslessEncoding == EncodingType::Raw) {
+                m_losslessEncoding = encoding;
+            }
+            if (forwardCompressed) {
                 m_supportedEncodingsServer.push_back(encoding);
             }
             break;
@@ -371,19 +546,37 @@ void VncTunnel::processSetEncodings()
         if ((int32_t)encoding >= (int32_t)EncodingType::JpegQualityLowest && (int32_t)encoding <= (int32_t)EncodingType::JpegQualityHighest) {
             m_supportedEncodingsClient.insert(encoding);
             m_supportedEncodingsServer.push_back(encoding);
+            if (m_jpegQualityLevel < 0) {
+                m_jpegQualityLevel = (int32_t)encoding - (int32_t)EncodingType::JpegQualityLowest;
+            }
         }
     }
 
     if (!clientSupportsEncoding(EncodingType::DesktopName)) {
         m_supportedEncodingsServer.push_back(EncodingType::DesktopName);    // We always ask to get desktop name updates from server
     }
-
-    m_currentConnection->sendSetEncodings(m_supportedEncodingsServer);
 }
 
 void VncTunnel::processFramebufferUpdateRequest()
 {
-    cFmt().forward_directly(sStream(), sizeof(FramebufferUpdateRequestMessage));
+    if (!m_feed) {
+        cFmt().forward_directly(sStream(), sizeof(FramebufferUpdateRequestMessage));
+        return;
+    }
+
+    FramebufferUpdateRequestMessage message;
+    cFmt().recv(message);
+
+    Rect area(message.xPosition, message.yPosition, message.width, message.height);
+
+    if (!message.incremental) {
+        m_damage.add(area);
+    }
+
+    m_requestedArea = m_updateRequested ? m_requestedArea.united(area) : area;
+    m_updateRequested = true;
+
+    trySendFramebufferUpdate();
 }
 
 void VncTunnel::processKeyEvent()
@@ -471,45 +664,48 @@ void VncTunnel::processFramebufferUpdate()
         sFmt().recv(rectangle);
 
         switch (rectangle.encodingType) {
-            // Pass-thru encodings
+            // Pass-thru encodings, pixels are translated if Xvnc sends in other format than the client uses.
         case EncodingType::Raw:
-        case EncodingType::CopyRect:
-        case EncodingType::Cursor:
-        case EncodingType::XCursor: {
-            std::size_t bufferSize = 0;
-
-            switch (rectangle.encodingType) {
-            case EncodingType::Raw:
-                bufferSize = rectangle.width * rectangle.height * m_pixelFormat.bitsPerPixel / 8;
-                break;
-
-            case EncodingType::CopyRect:
-                bufferSize = 4;
-                break;
-
-            case EncodingType::Cursor:
-                bufferSize = rectangle.width * rectangle.height * m_pixelFormat.bitsPerPixel / 8 + (rectangle.width + 7) / 8 * rectangle.height;
-                break;
+            cFmt().send(rectangle);
+            forwardPixels(rectangle.width * rectangle.height);
+            break;
 
-            case EncodingType::XCursor:
-                bufferSize = 6 + (rectangle.width + 7) / 8 * rectangle.height * 2;
-                break;
+        case EncodingType::CopyRect:
+            cFmt().send(rectangle);
+            sFmt().forward_directly(cStream(), 4);
+            break;
 
-            default:
-                assert(!"Not reached."); // This switch is supposed to handle all encoding types that the outter switch selects. This won't be reached unless one is changed and the other not.
-                break;
-            }
+        case EncodingType::Cursor:
+            cFmt().send(rectangle);
+            forwardPixels(rectangle.width * rectangle.height);
+            sFmt().forward_directly(cStream(), (rectangle.width + 7) / 8 * rectangle.height);
+            break;
 
+        case EncodingType::XCursor:
             cFmt().send(rectangle);
-            sFmt().forward_directly(cStream(), bufferSize);
+            sFmt().forward_directly(cStream(), 6 + (rectangle.width + 7) / 8 * rectangle.height * 2);
             break;
-        }
 
         case EncodingType::RRE: {
             cFmt().send(rectangle);
             uint32_t numberOfSubrectangles;
             sFmt().forward(cStream(), numberOfSubrectangles);
-            sFmt().forward_directly(cStream(), (m_pixelFormat.bitsPerPixel / 8) + numberOfSubrectangles * (m_pixelFormat.bitsPerPixel / 8 + 8));
+            forwardPixels(1);
+            forwardPixels(numberOfSubrectangles, 8);
+            break;
+        }
+
+        case EncodingType::Hextile:
+            cFmt().send(rectangle);
+            forwardHextileRectangle(rectangle);
+            break;
+
+        case EncodingType::Zlib:
+        case EncodingType::ZRLE: {
+            cFmt().send(rectangle);
+            uint32_t length;
+            sFmt().forward(cStream(), length);
+            sFmt().forward_directly(cStream(), length);
             break;
         }
 
@@ -609,7 +805,8 @@ void VncTunnel::processFramebufferUpdate()
                     sFmt().forward(cStream(), filter);
                 }
 
-                uint8_t bpp = m_pixelFormat.bitsPerPixel;
+                // Tight is never translated. It is only requested while the formats are the same, but rectangles sent before a format change may still come.
+                uint8_t bpp = m_currentConnection->pixelFormat().bitsPerPixel;
 
                 if (filter == TightFilter::Palette) {
                     uint8_t paletteLength;
@@ -652,6 +849,437 @@ void VncTunnel::processFramebufferUpdate()
     }
 }
 
+void VncTunnel::attachFeed(std::shared_ptr<SessionFeed> feed)
+{
+    if (m_feed) {
+        m_feed->unsubscribe(m_feedSubscriber);
+    }
+
+    m_feed = feed;
+    m_feedSubscriber = m_feed->subscribe();
+    m_feedStream.setFeed(m_feed);
+
+    // The new subscriber is readable right away, the select loop collects the initial state.
+    m_damage = Region();
+    m_cursorChangeQueued = false;
+}
+
+std::vector<EncodingType> VncTunnel::cursorEncodings()
+{
+    // Cursor shape is forwarded to the client only if it can use it, otherwise Xvnc draws the cursor into the framebuffer.
+    std::vector<EncodingType> encodings;
+
+    if (clientSupportsEncoding(EncodingType::Cursor)) {
+        encodings.push_back(EncodingType::Cursor);
+    }
+    if (clientSupportsEncoding(EncodingType::XCursor)) {
+        encodings.push_back(EncodingType::XCursor);
+    }
+
+    return encodings;
+}
+
+void VncTunnel::feedReceive()
+{
+    SessionFeed::Changes changes;
+    changes.damage = std::move(m_damage);
+    m_feed->collect(*m_feedSubscriber, changes);
+    m_damage = std::move(changes.damage);
+
+    for (const SessionFeed::DesktopSizeChange &change : changes.desktopSizeChanges) {
+        bool resized = change.rectangle.encodingType == EncodingType::DesktopSize || (ExtendedDesktopSizeStatus)change.rectangle.yPosition == ExtendedDesktopSizeStatus::NoError;
+
+        if (change.rectangle.encodingType == EncodingType::ExtendedDesktopSize && clientSupportsEncoding(EncodingType::ExtendedDesktopSize)) {
+            // Forwarded also when the resize failed, it may be the reply to client's SetDesktopSize.
+            m_desktopSizeChangesQueued.push_back(change);
+        } else if (resized) {
+            queueDesktopSizeChange(change.rectangle.width, change.rectangle.height);
+        }
+    }
+
+    if (changes.desktopNameChanged && clientSupportsEncoding(EncodingType::DesktopName)) {
+        m_desktopNameChangeQueued = true;
+    }
+
+    if (changes.cursorChanged && !cursorEncodings().empty()) {
+        m_cursorChangeQueued = true;
+    }
+
+    for (unsigned i = 0; i < changes.bells; i++) {
+        cFmt().send(BellMessage());
+    }
+
+    for (const std::string &text : changes.cutTexts) {
+        ServerCutTextMessage message;
+        message.length = text.length();
+        cFmt().send(message);
+        cFmt().send(text);
+    }
+
+    trySendFramebufferUpdate();
+}
+
+void VncTunnel::queueDesktopSizeChange(uint16_t width, uint16_t height)
+{
+    SessionFeed::DesktopSizeChange change;
+    change.rectangle.width = width;
+    change.rectangle.height = height;
+
+    if (clientSupportsEncoding(EncodingType::DesktopSize)) {
+        change.rectangle.encodingType = EncodingType::DesktopSize;
+    } else if (clientSupportsEncoding(EncodingType::ExtendedDesktopSize)) {
+        change.rectangle.encodingType = EncodingType::ExtendedDesktopSize;
+
+        SetDesktopSizeScreen screen;
+        screen.id = 0;
+        screen.xPosition = 0;
+        screen.yPosition = 0;
+        screen.width = width;
+        screen.height = height;
+        screen.flags = 0;
+        change.screens.push_back(screen);
+    } else {
+        // The client can not change its framebuffer size, it will receive only the part that fits.
+        return;
+    }
+
+    m_desktopSizeChangesQueued.push_back(change);
+}
+
+void VncTunnel::trySendFramebufferUpdate()
+{
+    if (!m_updateRequested) {
+        return;
+    }
+
+    // Size changes are sent first in the update and the pixels follow for the whole new framebuffer.
+    Rect area = m_requestedArea.intersected(Rect(0, 0, m_clientFramebufferWidth, m_clientFramebufferHeight));
+    for (const SessionFeed::DesktopSizeChange &change : m_desktopSizeChangesQueued) {
+        if (change.rectangle.encodingType == EncodingType::DesktopSize || (ExtendedDesktopSizeStatus)change.rectangle.yPosition == ExtendedDesktopSizeStatus::NoError) {
+            area = Rect(0, 0, change.rectangle.width, change.rectangle.height);
+        }
+    }
+
+    std::vector<Rect> rects;
+    int extraRectanglesCount;
+    m_updateBuffer.clear();
+
+    // Clients that support ZRLE or Tight get the pixels encoded by us, others get them Raw.
+    bool transcode = m_losslessEncoding != EncodingType::Raw;
+    int jpegQuality = -1;
+    if (clientSupportsEncoding(EncodingType::Tight) && m_jpegQualityLevel >= 0 && m_pixelFormat.bitsPerPixel >= 16) {
+        jpegQuality = TightEncoder::jpegQuality(m_jpegQualityLevel);
+    }
+
+    // Fewer colours make the encoded updates smaller on a congested link. Raw pixels would not get any smaller.
+    int colourDepth = ColourDepthPolicy::FullDepth;
+    if (transcode && m_colourDepthPolicy) {
+        colourDepth = m_colourDepthPolicy->depth();
+    }
+
+    // Every band may end up as several rectangles, one for each run of tiles with the same kind of content.
+    int maxRunWidth = (jpegQuality >= 0) ? TightEncoder::TileSize : TightEncoder::MaxRectangleWidth;
+    auto maxRectangleCount = [transcode, maxRunWidth](const std::vector<Rect> &rects) {
+        std::size_t count = 0;
+        for (const Rect &rect : rects) {
+            count += transcode ? (rect.width + maxRunWidth - 1) / maxRunWidth : 1;
+        }
+        return count;
+    };
+
+    {
+        // The thread of the feed may be changing the framebuffer. Everything is copied out with the lock held and sent to the client without it.
+        Framebuffer &framebuffer = m_feed->framebuffer();
+        std::lock_guard<std::mutex> guard(framebuffer.mutex());
+
+        if (m_cursorChangeQueued) {
+            m_cursor = framebuffer.cursor();
+            m_cursorChangeQueued = m_cursor.valid && clientSupportsEncoding(m_cursor.encoding);
+        }
+
+        area = area.intersected(framebuffer.rect());
+        rects = m_damage.rects(area);
+
+        if (transcode) {
+            rects = splitIntoBands(rects, BandHeight);
+        }
+
+        extraRectanglesCount = countExtraRectangles();
+        if (maxRectangleCount(rects) > (std::size_t)(std::numeric_limits<uint16_t>::max() - extraRectanglesCount)) {
+            rects = { m_damage.bounds().intersected(area) };
+            if (transcode) {
+                rects = splitIntoBands(rects, BandHeight);
+            }
+        }
+
+        if (transcode) {
+            // The bands are encoded in parallel once the lock is released.
+            m_encodedRectangles.resize(rects.size());
+            for (std::size_t i = 0; i < rects.size(); i++) {
+                convertRectangle(framebuffer, rects[i], m_encodedRectangles[i].pixels, colourDepth);
+            }
+        } else {
+            for (const Rect &rect : rects) {
+                appendRawRectangle(framebuffer, rect, m_updateBuffer);
+            }
+        }
+    }
+
+    std::size_t rectangleCount = rects.size();
+    if (transcode) {
+        rectangleCount = encodeBands(rects, jpegQuality);
+    }
+
+    if (rects.empty() && extraRectanglesCount == 0) {
+        return;
+    }
+
+    FramebufferUpdateMessage message;
+    message.numberOfRectangles = rectangleCount + extraRectanglesCount;
+    cFmt().send(message);
+
+    sendExtraRectangles();
+
+    cFmt().send_raw(m_updateBuffer);
+
+    if (m_colourDepthPolicy && m_colourDepthPolicy->updateSent()) {
+        Log::info() << "Client " << (intptr_t)this << " gets " << m_colourDepthPolicy->depth() << " bit colours now, backlog " << m_colourDepthPolicy->backlog() / 1024 << " KiB, throughput " << (unsigned long)(m_colourDepthPolicy->throughput() / 1024) << " KiB/s." << std::endl;
+    }
+
+    for (const Rect &rect : rects) {
+        m_damage.subtract(rect);
+    }
+
+    m_updateRequested = false;
+}
+
+std::size_t VncTunnel::encodeBands(const std::vector<Rect> &bands, int jpegQuality)
+{
+    m_zrleEncoder.setPixelFormat(m_pixelFormat);
+    m_tightEncoder.setPixelFormat(m_pixelFormat);
+
+    std::vector<EncoderPool::Task> tasks;
+    for (std::size_t i = 0; i < bands.size(); i++) {
+        tasks.push_back(std::bind(&VncTunnel::encodeBand, this, std::cref(bands[i]), std::ref(m_encodedRectangles[i]), jpegQuality));
+    }
+
+    m_encoderPool.run(tasks);
+
+    std::size_t rectangleCount = 0;
+    for (std::size_t i = 0; i < bands.size(); i++) {
+        EncodedRectangle &encoded = m_encodedRectangles[i];
+
+        m_deflateStreams.start(encoded.data, encoded.chunks);
+        m_updateBuffer.insert(m_updateBuffer.end(), encoded.data.begin(), encoded.data.end());
+        rectangleCount += encoded.rectangleCount;
+    }
+
+    return rectangleCount;
+}
+
+void VncTunnel::encodeBand(const Rect &band, EncodedRectangle &encoded, int jpegQuality) const
+{
+    int bytesPerPixel = m_pixelFormat.bytesPerPixel();
+    std::size_t stride = band.width * bytesPerPixel;
+
+    encoded.data.clear();
+    encoded.chunks.clear();
+    encoded.rectangleCount = 0;
+
+    // Photographic tiles are sent as JPEG if the client allows it, the rest stays lossless.
+    std::vector<bool> photographic;
+    for (int x = 0; x < band.width; x += TightEncoder::TileSize) {
+        int width = std::min(TightEncoder::TileSize, band.width - x);
+        photographic.push_back(jpegQuality >= 0 && m_tightEncoder.isPhotographic(&encoded.pixels[x * bytesPerPixel], stride, width, band.height));
+    }
+
+    // Runs of tiles of the same kind are sent as one rectangle.
+    std::size_t tile = 0;
+    while (tile < photographic.size()) {
+        std::size_t end = tile + 1;
+        while (end < photographic.size() && photographic[end] == photographic[tile] && (int)(end - tile) * TightEncoder::TileSize < TightEncoder::MaxRectangleWidth) {
+            end++;
+        }
+
+        int x = tile * TightEncoder::TileSize;
+        Rect rect(band.x + x, band.y, std::min<int>(band.width, end * TightEncoder::TileSize) - x, band.height);
+        const uint8_t *pixels = &encoded.pixels[x * bytesPerPixel];
+
+        if (photographic[tile]) {
+            m_tightEncoder.encodeJpeg(rect, pixels, stride, jpegQuality, encoded.data);
+        } else if (m_losslessEncoding == EncodingType::ZRLE) {
+            m_zrleEncoder.encode(rect, pixels, stride, encoded.data, encoded.chunks);
+        } else {
+            m_tightEncoder.encodeLossless(rect, pixels, stride, encoded.data, encoded.chunks);
+        }
+
+        encoded.rectangleCount++;
+        tile = end;
+    }
+}
+
+void VncTunnel::convertRectangle(const Framebuffer &framebuffer, const Rect &rect, std::vector<uint8_t> &buffer, int colourDepth)
+{
+    PixelConverter &converter = pixelConverter(colourDepth);
+
+    std::size_t rowLength = rect.width * m_pixelFormat.bytesPerPixel();
+    buffer.resize(rowLength * rect.height);
+
+    for (int y = 0; y < rect.height; y++) {
+        converter.convert(framebuffer.data(rect.x, rect.y + y), &buffer[y * rowLength], rect.width);
+    }
+}
+
+void VncTunnel::appendRawRectangle(const Framebuffer &framebuffer, const Rect &rect, std::vector<uint8_t> &buffer)
+{
+    FramebufferUpdateRectangle rectangle;
+    rectangle.xPosition = rect.x;
+    rectangle.yPosition = rect.y;
+    rectangle.width = rect.width;
+    rectangle.height = rect.height;
+    rectangle.encodingType = EncodingType::Raw;
+    rectangle.hton();
+
+    const uint8_t *header = (const uint8_t *)&rectangle;
+    buffer.insert(buffer.end(), header, header + sizeof(rectangle));
+
+    PixelConverter &converter = pixelConverter();
+
+    std::size_t rowLength = rect.width * m_pixelFormat.bytesPerPixel();
+    std::size_t offset = buffer.size();
+    buffer.resize(offset + rowLength * rect.height);
+
+    for (int y = 0; y < rect.height; y++) {
+        converter.convert(framebuffer.data(rect.x, rect.y + y), &buffer[offset + y * rowLength], rect.width);
+    }
+}
+
+void VncTunnel::sendCursor()
+{
+    const Framebuffer::Cursor &cursor = m_cursor;
+
+    FramebufferUpdateRectangle rectangle;
+    rectangle.xPosition = cursor.hotspotX;
+    rectangle.yPosition = cursor.hotspotY;
+    rectangle.width = cursor.width;
+    rectangle.height = cursor.height;
+    rectangle.encodingType = cursor.encoding;
+    cFmt().send(rectangle);
+
+    if (cursor.encoding == EncodingType::XCursor) {
+        cFmt().send_raw(cursor.data);
+        return;
+    }
+
+    // Cursor pixels are in the format of the framebuffer and are followed by bitmask that doesn't need conversion.
+    std::size_t pixelCount = cursor.width * cursor.height;
+    std::size_t pixelsLength = pixelCount * m_feed->framebuffer().bytesPerPixel();
+
+    m_pixelBuffer.resize(pixelCount * m_pixelFormat.bytesPerPixel());
+    pixelConverter().convert(cursor.data.data(), m_pixelBuffer.data(), pixelCount);
+
+    cFmt().send_raw(m_pixelBuffer);
+    cFmt().send_raw(cursor.data.data() + pixelsLength, cursor.data.size() - pixelsLength);
+}
+
+PixelConverter &VncTunnel::pixelConverter(int colourDepth)
+{
+    // Pixels come in the format of the shadow framebuffer, or in the format Xvnc was told to use.
+    PixelFormat sourcePixelFormat = m_feed ? m_feed->framebuffer().pixelFormat() : m_currentConnection->pixelFormat();
+    if (!m_pixelConverter || m_pixelConverter->from() != sourcePixelFormat || m_pixelConverter->to() != m_pixelFormat || m_pixelConverter->colourDepth() != colourDepth) {
+        m_pixelConverter.reset(new PixelConverter(sourcePixelFormat, m_pixelFormat, colourDepth));
+    }
+
+    return *m_pixelConverter;
+}
+
+bool VncTunnel::translatesPixels()
+{
+    // Colour map formats can not be translated, Xvnc has to send in them.
+    return m_translatePixels && !m_shadowFramebuffer && m_pixelFormat.trueColourFlag && m_currentConnection->nativePixelFormat().trueColourFlag;
+}
+
+PixelFormat VncTunnel::serverPixelFormat()
+{
+    return translatesPixels() ? m_currentConnection->nativePixelFormat() : m_pixelFormat;
+}
+
+void VncTunnel::forwardPixels(std::size_t count, std::size_t trailingLength)
+{
+    PixelConverter &converter = pixelConverter();
+    std::size_t fromBytesPerPixel = converter.from().bytesPerPixel();
+    std::size_t toBytesPerPixel = m_pixelFormat.bytesPerPixel();
+
+    if (converter.identity()) {
+        sFmt().forward_directly(cStream(), count * (fromBytesPerPixel + trailingLength));
+        return;
+    }
+
+    if (trailingLength) {
+        // Pixels interleaved with other data, e.g. colours of subrectangles.
+        uint8_t pixel[4];
+        uint8_t translated[4];
+        for (std::size_t i = 0; i < count; i++) {
+            sFmt().recv_raw(pixel, fromBytesPerPixel);
+            converter.convert(pixel, translated, 1);
+            cFmt().send_raw(translated, toBytesPerPixel);
+            sFmt().forward_directly(cStream(), trailingLength);
+        }
+        return;
+    }
+
+    const std::size_t BatchSize = 4096;
+    m_serverPixelBuffer.resize(std::min(count, BatchSize) * fromBytesPerPixel);
+    m_pixelBuffer.resize(std::min(count, BatchSize) * toBytesPerPixel);
+
+    while (count > 0) {
+        std::size_t batch = std::min(count, BatchSize);
+        sFmt().recv_raw(m_serverPixelBuffer.data(), batch * fromBytesPerPixel);
+        converter.convert(m_serverPixelBuffer.data(), m_pixelBuffer.data(), batch);
+        cFmt().send_raw(m_pixelBuffer.data(), batch * toBytesPerPixel);
+        count -= batch;
+    }
+}
+
+void VncTunnel::forwardHextileRectangle(const FramebufferUpdateRectangle &rectangle)
+{
+    // Hextile has no length, all the tiles have to be walked through to find where the rectangle ends.
+    for (int y = 0; y < rectangle.height; y += HextileTileSize) {
+        for (int x = 0; x < rectangle.width; x += HextileTileSize) {
+            int tileWidth = std::min(HextileTileSize, rectangle.width - x);
+            int tileHeight = std::min(HextileTileSize, rectangle.height - y);
+
+            uint8_t subencoding;
+            sFmt().forward(cStream(), subencoding);
+
+            if (subencoding & HextileRaw) {
+                forwardPixels(tileWidth * tileHeight);
+                continue;
+            }
+
+            std::size_t pixelCount = 0;
+            if (subencoding & HextileBackgroundSpecified) {
+                pixelCount++;
+            }
+            if (subencoding & HextileForegroundSpecified) {
+                pixelCount++;
+            }
+            forwardPixels(pixelCount);
+
+            if (subencoding & HextileAnySubrects) {
+                uint8_t numberOfSubrectangles;
+                sFmt().forward(cStream(), numberOfSubrectangles);
+
+                if (subencoding & HextileSubrectsColoured) {
+                    forwardPixels(numberOfSubrectangles, 2);
+                } else {
+                    sFmt().forward_directly(cStream(), numberOfSubrectangles * 2);
+                }
+            }
+        }
+    }
+}
+
 void VncTunnel::processSetColourMapEntries()
 {
     SetColourMapEntriesMessage message;
@@ -729,10 +1357,17 @@ void VncTunnel::openSessionHandler(int id)
 
 void VncTunnel::switchToConnection(std::shared_ptr<Xvnc> xvnc)
 {
-    if (m_tightEncodingDisabled) {
-        m_tightEncodingDisabled = false;
-        if (clientSupportsEncoding(EncodingType::Tight)) {
-            m_supportedEncodingsServer.insert(m_supportedEncodingsServer.begin(), EncodingType::Tight);
+    if (m_zlibEncodingsDisabled) {
+        m_zlibEncodingsDisabled = false;
+        updateSupportedEncodings();
+    }
+
+    if (m_shadowFramebuffer) {
+        // Session that was kept after its client left can be taken over without authenticating again.
+        std::shared_ptr<SessionFeed> keptFeed = m_sessionFeedManager.reclaim(xvnc->id());
+        if (keptFeed) {
+            switchToFeed(keptFeed);
+            return;
         }
     }
 
@@ -751,21 +1386,43 @@ void VncTunnel::switchToConnection(std::shared_ptr<Xvnc> xvnc)
 
 void VncTunnel::connectionSwitched()
 {
+    assert(m_potentialConnection);
+
+    if (m_shadowFramebuffer) {
+        std::unique_ptr<XvncConnection> connection(m_potentialConnection);
+        m_potentialConnection = nullptr;
+
+        // The client is authenticated now. If other clients already watch the session, join them and let the new connection go.
+        std::shared_ptr<SessionFeed> feed = m_sessionFeedManager.join(connection->xvnc()->id(), cursorEncodings());
+        if (feed) {
+            Log::debug() << "Client " << (intptr_t)this << " joined shared connection to Xvnc #" << feed->xvnc()->id() << "." << std::endl;
+        } else {
+            // The feed takes over the connection
+            feed = std::make_shared<SessionFeed>(std::move(connection), cursorEncodings());
+            m_sessionFeedManager.share(feed);
+        }
+
+        switchToFeed(feed);
+        return;
+    }
+
     assert(m_greeterConnection);
     m_greeterManager.releaseGreeter(m_greeterConnection);
     m_greeterConnection = nullptr;
 
-    assert(m_potentialConnection);
     delete m_currentConnection;
     m_currentConnection = m_potentialConnection;
     m_potentialConnection = nullptr;
 
     m_selector.cancel();
 
-    if (m_currentConnection->pixelFormat() != m_pixelFormat) {
-        m_currentConnection->sendSetPixelFormat(m_pixelFormat);
+    // With translate-pixels the new Xvnc usually already sends in the right format and doesn't have to re-encode anything.
+    PixelFormat pixelFormat = serverPixelFormat();
+    if (m_currentConnection->pixelFormat() != pixelFormat) {
+        m_currentConnection->sendSetPixelFormat(pixelFormat);
     }
 
+    updateSupportedEncodings();
     m_currentConnection->sendSetEncodings(m_supportedEncodingsServer);
 
     m_currentConnection->sendNonIncrementalFramebufferUpdateRequest(); // XXX, TODO: The response to this may come as surprise to the client if it didn't have pending request.
@@ -777,19 +1434,68 @@ void VncTunnel::connectionSwitched()
     }
 }
 
+void VncTunnel::switchToFeed(std::shared_ptr<SessionFeed> feed)
+{
+    assert(m_greeterConnection);
+    m_greeterManager.releaseGreeter(m_greeterConnection);
+    m_greeterConnection = nullptr;
+
+    m_selector.cancel();
+
+    attachFeed(feed);
+
+    {
+        Framebuffer &framebuffer = m_feed->framebuffer();
+        std::lock_guard<std::mutex> guard(framebuffer.mutex());
+
+        if (framebuffer.width() != m_clientFramebufferWidth || framebuffer.height() != m_clientFramebufferHeight) {
+            queueDesktopSizeChange(framebuffer.width(), framebuffer.height());
+        }
+    }
+
+    if (clientSupportsEncoding(EncodingType::DesktopName)) {
+        m_desktopNameChangeQueued = true;
+    }
+}
+
 int VncTunnel::countExtraRectangles()
 {
     int count = 0;
 
+    count += m_desktopSizeChangesQueued.size();
+
     if (m_desktopNameChangeQueued) {
         count++;
     }
 
+    if (m_cursorChangeQueued) {
+        count++;
+    }
+
     return count;
 }
 
 void VncTunnel::sendExtraRectangles()
 {
+    for (const SessionFeed::DesktopSizeChange &change : m_desktopSizeChangesQueued) {
+        cFmt().send(change.rectangle);
+
+        if (change.rectangle.encodingType == EncodingType::ExtendedDesktopSize) {
+            ExtendedDesktopSizeRectangleData rectangleData;
+            rectangleData.numberOfScreens = change.screens.size();
+            cFmt().send(rectangleData);
+            cFmt().send(change.screens);
+
+            if ((ExtendedDesktopSizeStatus)change.rectangle.yPosition != ExtendedDesktopSizeStatus::NoError) {
+                continue;
+            }
+        }
+
+        m_clientFramebufferWidth = change.rectangle.width;
+        m_clientFramebufferHeight = change.rectangle.height;
+    }
+    m_desktopSizeChangesQueued.clear();
+
     if (m_desktopNameChangeQueued) {
         m_desktopNameChangeQueued = false;
         FramebufferUpdateRectangle rectangle;
@@ -801,12 +1507,22 @@ void VncTunnel::sendExtraRectangles()
 
         cFmt().send(rectangle);
 
-        std::string name = m_currentConnection->desktopName();
+        std::string name = desktopName();
 
         uint32_t nameLength = name.length();
         cFmt().send(nameLength);
         cFmt().send(name);
     }
+
+    if (m_cursorChangeQueued) {
+        m_cursorChangeQueued = false;
+        sendCursor();
+    }
+}
+
+std::string VncTunnel::desktopName()
+{
+    return m_feed ? m_feed->desktopName() : m_currentConnection->desktopName();
 }
 
 std::vector<SecurityType> VncTunnel::configuredSecurityTypes()
@@ -29,20 +29,33 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <set>
 #include <utility>
 #include <vector>
 
 #include "rfb.h"
+#include "ColourDepthPolicy.h"
 #include "ControllerConnection.h"
 #include "ControllerManager.h"
+#include "DeflateStreams.h"
+#include "EncoderPool.h"
+#include "Framebuffer.h"
 #include "GreeterConnection.h"
 #include "GreeterManager.h"
+#include "PixelConverter.h"
 #include "ReadSelector.h"
+#include "Region.h"
+#include "SessionFeed.h"
+#include "SessionFeedManager.h"
 #include "Stream.h"
 #include "StreamFormatter.h"
+#include "TightEncoder.h"
+#include "TLSHandshakePool.h"
+#include "TLSSessionTickets.h"
 #include "XvncConnection.h"
 #include "XvncManager.h"
+#include "ZRLEEncoder.h"
 
 
 /**
@@ -51,6 +64,8 @@
  * This class acts as VNC proxy that forwards VNC messages between its client and associated XvncConnection. It can switch the client from current to a new XvncConnection.
  * It also handles communication with greeter using GreeterConnection if one is displayed in current session.
  *
+ * Optionally it keeps a shadow framebuffer of the session. The connection to Xvnc is then owned by a SessionFeed that applies updates to the shadow framebuffer and the client receives only the latest content of the changed areas whenever it asks for an update.
+ *
  * This class is meant to live in its own thread started by start() method. The thread quits and this class gets deleted when the client disconnects.
  *
  * @remark This class must be allocated with new operator. It owns itself and deletes itself at the end of start function.
@@ -67,9 +82,13 @@ public:
      * @param xvncManager Reference to XvncManager
      * @param greeterManager Reference to GreeterManager
      * @param controllerManager ControllerManager
+     * @param tlsSessionTickets Reference to TLSSessionTickets
+     * @param tlsHandshakePool Reference to TLSHandshakePool
+     * @param sessionFeedManager Reference to SessionFeedManager
+     * @param encoderPool Reference to EncoderPool
      * @param fd Accepted file descriptor with VNC client on the other side.
      */
-    VncTunnel(XvncManager &xvncManager, GreeterManager &greeterManager, ControllerManager &controllerManager, int fd);
+    VncTunnel(XvncManager &xvncManager, GreeterManager &greeterManager, ControllerManager &controllerManager, TLSSessionTickets &tlsSessionTickets, TLSHandshakePool &tlsHandshakePool, SessionFeedManager &sessionFeedManager, EncoderPool &encoderPool, int fd);
 
     VncTunnel(const VncTunnel &) = delete;
     VncTunnel &operator=(const VncTunnel &) = delete;
@@ -85,7 +104,7 @@ public:
 
 private:
     Stream &cStream() { return *m_stream; }
-    Stream &sStream() { return m_currentConnection->stream(); }
+    Stream &sStream() { return m_feed ? (Stream &)m_feedStream : m_currentConnection->stream(); }
     StreamFormatter &cFmt() { return m_streamFormatter; }
     StreamFormatter &sFmt() { return m_currentConnection->fmt(); }
 
@@ -100,6 +119,7 @@ private:
 
     void processSetPixelFormat();
     void processSetEncodings();
+    void updateSupportedEncodings();
     void processFramebufferUpdateRequest();
     void processKeyEvent();
     void processPointerEvent();
@@ -107,10 +127,31 @@ private:
     void processSetDesktopSize();
 
     void processFramebufferUpdate();
+    void forwardHextileRectangle(const FramebufferUpdateRectangle &rectangle);
+    bool translatesPixels();
+    PixelFormat serverPixelFormat();
+
+    /**
+     * Forward count pixels from Xvnc to the client, translated to the client's pixel format. Each pixel may be followed by trailingLength bytes that are forwarded unchanged.
+     */
+    void forwardPixels(std::size_t count, std::size_t trailingLength = 0);
     void processSetColourMapEntries();
     void processBell();
     void processServerCutText();
 
+    void attachFeed(std::shared_ptr<SessionFeed> feed);
+    std::vector<EncodingType> cursorEncodings();
+    void feedReceive();
+    void queueDesktopSizeChange(uint16_t width, uint16_t height);
+    void trySendFramebufferUpdate();
+    struct EncodedRectangle;
+    std::size_t encodeBands(const std::vector<Rect> &bands, int jpegQuality);
+    void encodeBand(const Rect &band, EncodedRectangle &encoded, int jpegQuality) const;
+    void convertRectangle(const Framebuffer &framebuffer, const Rect &rect, std::vector<uint8_t> &buffer, int colourDepth);
+    void appendRawRectangle(const Framebuffer &framebuffer, const Rect &rect, std::vector<uint8_t> &buffer);
+    void sendCursor();
+    PixelConverter &pixelConverter(int colourDepth = ColourDepthPolicy::FullDepth);
+
     void sendReason(std::string reason);
 
     /**
@@ -125,10 +166,13 @@ private:
 
     void switchToConnection(std::shared_ptr<Xvnc> xvnc);
     void connectionSwitched();
+    void switchToFeed(std::shared_ptr<SessionFeed> feed);
 
     int countExtraRectangles();
     void sendExtraRectangles();
 
+    std::string desktopName();
+
     std::vector<SecurityType> configuredSecurityTypes();
 
     bool clientSupportsEncoding(EncodingType encoding);
@@ -137,9 +181,14 @@ private:
     XvncManager &m_xvncManager;
     GreeterManager &m_greeterManager;
     ControllerManager &m_controllerManager;
+    TLSSessionTickets &m_tlsSessionTickets;
+    TLSHandshakePool &m_tlsHandshakePool;
+    SessionFeedManager &m_sessionFeedManager;
+    EncoderPool &m_encoderPool;
 
     Stream *m_stream;
     StreamFormatter m_streamFormatter;
+    std::string m_clientAddress;
 
     ReadSelector m_selector;
 
@@ -150,6 +199,9 @@ private:
     SecurityType m_securityType = SecurityType::Invalid;
     PixelFormat m_pixelFormat;
 
+    // List of encodings as the client sent them.
+    std::vector<EncodingType> m_clientEncodings;
+
     // List of encodings that both our client and we support.
     std::set<EncodingType> m_supportedEncodingsClient;
 
@@ -159,8 +211,49 @@ private:
     bool m_tightZlibResetQueued = false;
     bool m_desktopNameChangeQueued = false;
 
+    // Shadow framebuffer mode, the session is received through m_feed instead of m_currentConnection.
+    bool m_shadowFramebuffer;
+    // Xvnc keeps its native pixel format and forwarded pixels are translated to the client's format.
+    bool m_translatePixels;
+    std::shared_ptr<SessionFeed> m_feed;
+    std::shared_ptr<SessionFeed::Subscriber> m_feedSubscriber;
+    SessionFeed::MessageStream m_feedStream; // Messages for Xvnc are forwarded through the feed.
+    std::unique_ptr<PixelConverter> m_pixelConverter;
+    std::unique_ptr<ColourDepthPolicy> m_colourDepthPolicy; // Only if adaptive-colour-depth is enabled.
+    std::vector<uint8_t> m_updateBuffer;
+    std::vector<uint8_t> m_pixelBuffer;
+    std::vector<uint8_t> m_serverPixelBuffer;
+    Framebuffer::Cursor m_cursor; // Copy of the cursor taken together with the pixels.
+
+    // Bands encoded by m_encoderPool, the buffers are reused between updates.
+    static constexpr int BandHeight = 64;
+    struct EncodedRectangle {
+        std::vector<uint8_t> pixels; // Converted to the client's pixel format.
+        std::vector<uint8_t> data;
+        std::vector<DeflateStreams::Chunk> chunks;
+        std::size_t rectangleCount = 0;
+    };
+    std::vector<EncodedRectangle> m_encodedRectangles;
+    EncodingType m_losslessEncoding = EncodingType::Raw; // ZRLE or Tight, whichever the client prefers. Raw if it supports neither.
+    int m_jpegQualityLevel = -1;
+    ZRLEEncoder m_zrleEncoder;
+    TightEncoder m_tightEncoder;
+    DeflateStreams m_deflateStreams;
+
+    Region m_damage; // Areas of the shadow framebuffer that changed since they were last sent to the client.
+    bool m_updateRequested = false;
+    Rect m_requestedArea;
+
+    // Framebuffer size as known by the client.
+    uint16_t m_clientFramebufferWidth = 0;
+    uint16_t m_clientFramebufferHeight = 0;
+
+    std::vector<SessionFeed::DesktopSizeChange> m_desktopSizeChangesQueued;
+    bool m_cursorChangeQueued = false;
+
     // Some VNC clients do not handle reset of zlib streams in tight encoding correctly. To minimize the problems, disable tight encoding if we know that we'll be switching to another Xvnc soon.
-    bool m_tightEncodingDisabled = false;
+    // ZRLE and Zlib can not reset their zlib streams at all, they must not be forwarded before the switch.
+    bool m_zlibEncodingsDisabled = false;
 };
 
 #endif // INCOMINGCLIENT_H
@@ -32,6 +32,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <iostream>
 #include <random>
 #include <string>
@@ -339,6 +340,30 @@ void Xvnc::generateXAuthorityFile()
     pclose(fp);
 }
 
+void Xvnc::registerFramebuffer(std::shared_ptr<Framebuffer> framebuffer)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    m_framebuffers.erase(std::remove_if(m_framebuffers.begin(), m_framebuffers.end(), [](const std::weak_ptr<Framebuffer> &framebuffer) {
+        return framebuffer.expired();
+    }), m_framebuffers.end());
+
+    m_framebuffers.push_back(framebuffer);
+}
+
+std::shared_ptr<Framebuffer> Xvnc::cachedFramebuffer()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    for (auto &weakFramebuffer : m_framebuffers) {
+        if (auto framebuffer = weakFramebuffer.lock()) {
+            return framebuffer;
+        }
+    }
+
+    return nullptr;
+}
+
 bool Xvnc::isKeyApproved(std::string key)
 {
     std::lock_guard<std::mutex> guard(m_lock);
@@ -29,14 +29,17 @@
 
 #include <unistd.h>
 
+#include <memory>
 #include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <sys/socket.h>
 #include <sys/un.h>
 
 #include "FdStream.h"
+#include "Framebuffer.h"
 #include "XvncManager.h"
 
 
@@ -112,6 +115,17 @@ public:
      */
     void disconnect();
 
+    /**
+     * Register framebuffer that a live connection keeps up to date, so new connections can start from its copy.
+     * Only weak reference is kept, the framebuffer is forgotten when its owner releases it.
+     */
+    void registerFramebuffer(std::shared_ptr<Framebuffer> framebuffer);
+
+    /**
+     * Return framebuffer registered by any live connection or nullptr if there is none.
+     */
+    std::shared_ptr<Framebuffer> cachedFramebuffer();
+
     /**
      * Returns whether given controller key was approved for controlling this session.
      */
@@ -145,6 +159,8 @@ private:
     std::string m_sessionUsername;
 
     std::set<std::string> m_approvedControllerKeys;
+
+    std::vector<std::weak_ptr<Framebuffer>> m_framebuffers;
 };
 
 #endif // XVNC_H
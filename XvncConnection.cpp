@@ -182,6 +182,8 @@ void XvncConnection::handleVncAuthSecurityWithPassword(std::string password)
     // Send response back
     fmt().send(challenge_response);
 
+    m_authenticated = true;
+
     receiveSecurityResult();
 
     completeInitialization();
@@ -269,6 +271,8 @@ void XvncConnection::handleVeNCryptSecurityWithCredentials(std::string username,
     fmt().send(username);
     fmt().send(password);
 
+    m_authenticated = true;
+
     receiveSecurityResult();
 
     completeInitialization();
@@ -300,6 +304,7 @@ void XvncConnection::completeInitialization()
     m_framebufferHeight = serverInit.framebufferHeight;
 
     m_pixelFormat = serverInit.serverPixelFormat;
+    m_nativePixelFormat = serverInit.serverPixelFormat;
 
     m_xvnc->setDesktopName(fmt().recv_string(serverInit.nameLength));
 
@@ -348,6 +353,18 @@ void XvncConnection::sendNonIncrementalFramebufferUpdateRequest()
     fmt().send(message);
 }
 
+void XvncConnection::sendIncrementalFramebufferUpdateRequest()
+{
+    FramebufferUpdateRequestMessage message;
+    message.xPosition = 0;
+    message.yPosition = 0;
+    message.width = framebufferWidth();
+    message.height = framebufferHeight();
+    message.incremental = true;
+
+    fmt().send(message);
+}
+
 void XvncConnection::setFramebufferSize(uint16_t width, uint16_t height)
 {
     m_framebufferWidth = width;
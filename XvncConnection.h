@@ -95,6 +95,7 @@ public:
     void sendSetPixelFormat(const PixelFormat &pixelFormat);
     void sendSetEncodings(const std::vector<EncodingType> &encodings);
     void sendNonIncrementalFramebufferUpdateRequest();
+    void sendIncrementalFramebufferUpdateRequest();
 
     /**
      * Stream used to communicate with the VNC server.
@@ -110,10 +111,22 @@ public:
     uint16_t framebufferHeight() const { return m_framebufferHeight; }
     void setFramebufferSize(uint16_t width, uint16_t height);
 
+    std::shared_ptr<Xvnc> xvnc() const { return m_xvnc; }
+
     std::string desktopName() const { return m_xvnc->desktopName(); }
     void setDesktopName(const std::string &desktopName);
     PixelFormat pixelFormat() const { return m_pixelFormat; }
 
+    /**
+     * The pixel format Xvnc announced before it was told to use any other.
+     */
+    PixelFormat nativePixelFormat() const { return m_nativePixelFormat; }
+
+    /**
+     * Whether Xvnc required password or credentials to accept this connection.
+     */
+    bool authenticated() const { return m_authenticated; }
+
 private:
     SecurityType startInitialization(std::set<SecurityType> supportedTypes);
     void handleNoneSecurity();
@@ -134,6 +147,9 @@ private:
 
     uint16_t m_framebufferWidth, m_framebufferHeight;
     PixelFormat m_pixelFormat;
+    PixelFormat m_nativePixelFormat;
+
+    bool m_authenticated = false;
 
     ConnectionInitializedHandler m_connectionInitializedHandler;
     PasswordRequestHandler m_passwordRequestHandler;
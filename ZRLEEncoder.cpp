@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <algorithm>
+#include <cstring>
+
+#include "Palette.h"
+#include "ZRLEEncoder.h"
+
+
+constexpr int ZRLEEncoder::TileSize;
+constexpr int ZRLEEncoder::CompressionLevel;
+constexpr std::size_t ZRLEEncoder::MaxPaletteSize;
+
+
+ZRLEEncoder::ZRLEEncoder()
+{
+}
+
+void ZRLEEncoder::setPixelFormat(const PixelFormat &pixelFormat)
+{
+    m_bytesPerPixel = pixelFormat.bytesPerPixel();
+    m_compressedPixelSize = m_bytesPerPixel;
+    m_compressedPixelOffset = 0;
+
+    if (pixelFormat.trueColourFlag && pixelFormat.bitsPerPixel == 32 && pixelFormat.depth <= 24) {
+        uint32_t mask = ((uint32_t)pixelFormat.redMax << pixelFormat.redShift) | ((uint32_t)pixelFormat.greenMax << pixelFormat.greenShift) | ((uint32_t)pixelFormat.blueMax << pixelFormat.blueShift);
+
+        bool fitsInLeastSignificant = (mask & 0xff000000) == 0;
+        bool fitsInMostSignificant = (mask & 0x000000ff) == 0;
+
+        if (fitsInLeastSignificant || fitsInMostSignificant) {
+            m_compressedPixelSize = 3;
+            // Offset of the three bytes in the pixel as it lies in memory.
+            m_compressedPixelOffset = (fitsInLeastSignificant == !pixelFormat.bigEndianFlag) ? 0 : 1;
+        }
+    }
+}
+
+void ZRLEEncoder::encode(const Rect &rect, const uint8_t *pixels, std::size_t stride, std::vector<uint8_t> &output, std::vector<DeflateStreams::Chunk> &chunks) const
+{
+    static thread_local std::vector<uint8_t> tiles;
+
+    tiles.clear();
+    for (int y = 0; y < rect.height; y += TileSize) {
+        for (int x = 0; x < rect.width; x += TileSize) {
+            encodeTile(pixels + y * stride + x * m_bytesPerPixel, stride, std::min(TileSize, rect.width - x), std::min(TileSize, rect.height - y), tiles);
+        }
+    }
+
+    FramebufferUpdateRectangle rectangle;
+    rectangle.xPosition = rect.x;
+    rectangle.yPosition = rect.y;
+    rectangle.width = rect.width;
+    rectangle.height = rect.height;
+    rectangle.encodingType = EncodingType::ZRLE;
+    rectangle.hton();
+
+    const uint8_t *header = (const uint8_t *)&rectangle;
+    output.insert(output.end(), header, header + sizeof(rectangle));
+
+    DeflateStreams::Chunk chunk;
+    chunk.lengthOffset = output.size();
+    chunk.encoding = EncodingType::ZRLE;
+    chunk.stream = 0;
+    chunks.push_back(chunk);
+
+    output.resize(chunk.lengthOffset + sizeof(uint32_t));
+    DeflateStreams::compress(tiles.data(), tiles.size(), CompressionLevel, output);
+
+    uint32_t length = htonl(output.size() - chunk.lengthOffset - sizeof(uint32_t));
+    std::memcpy(&output[chunk.lengthOffset], &length, sizeof(length));
+}
+
+void ZRLEEncoder::encodeTile(const uint8_t *pixels, std::size_t stride, int width, int height, std::vector<uint8_t> &output) const
+{
+    Palette palette;
+    bool paletteOverflow = false;
+    std::size_t runs = 0;
+
+    uint32_t previous = readPixel(pixels);
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = pixels + y * stride;
+        for (int x = 0; x < width; x++) {
+            uint32_t pixel = readPixel(row + x * m_bytesPerPixel);
+
+            if (pixel != previous || runs == 0) {
+                runs++;
+                previous = pixel;
+            }
+
+            if (!paletteOverflow && (!palette.insert(pixel) || palette.size() > MaxPaletteSize)) {
+                paletteOverflow = true;
+            }
+        }
+    }
+
+    if (!paletteOverflow && palette.size() == 1) {
+        output.push_back(1);
+        writeCompressedPixel(palette.colour(0), output);
+        return;
+    }
+
+    // Pick the smallest subencoding based on estimated sizes.
+    enum class Subencoding { Raw, PackedPalette, PlainRLE, PaletteRLE };
+
+    Subencoding subencoding = Subencoding::Raw;
+    std::size_t bestSize = width * height * m_compressedPixelSize;
+
+    std::size_t plainRLESize = runs * (m_compressedPixelSize + 1);
+    if (plainRLESize < bestSize) {
+        subencoding = Subencoding::PlainRLE;
+        bestSize = plainRLESize;
+    }
+
+    int bitsPerIndex = 0;
+    if (!paletteOverflow) {
+        std::size_t paletteRLESize = palette.size() * m_compressedPixelSize + runs * 2;
+        if (paletteRLESize < bestSize) {
+            subencoding = Subencoding::PaletteRLE;
+            bestSize = paletteRLESize;
+        }
+
+        if (palette.size() <= 16) {
+            bitsPerIndex = palette.size() <= 2 ? 1 : (palette.size() <= 4 ? 2 : 4);
+
+            std::size_t packedSize = palette.size() * m_compressedPixelSize + height * ((width * bitsPerIndex + 7) / 8);
+            if (packedSize <= bestSize) {
+                subencoding = Subencoding::PackedPalette;
+                bestSize = packedSize;
+            }
+        }
+    }
+
+    switch (subencoding) {
+    case Subencoding::Raw:
+        output.push_back(0);
+        for (int y = 0; y < height; y++) {
+            const uint8_t *row = pixels + y * stride;
+            for (int x = 0; x < width; x++) {
+                writeCompressedPixel(readPixel(row + x * m_bytesPerPixel), output);
+            }
+        }
+        break;
+
+    case Subencoding::PackedPalette:
+        output.push_back(palette.size());
+        for (std::size_t i = 0; i < palette.size(); i++) {
+            writeCompressedPixel(palette.colour(i), output);
+        }
+
+        for (int y = 0; y < height; y++) {
+            const uint8_t *row = pixels + y * stride;
+
+            uint8_t byte = 0;
+            int usedBits = 0;
+            for (int x = 0; x < width; x++) {
+                byte = (byte << bitsPerIndex) | palette.index(readPixel(row + x * m_bytesPerPixel));
+                usedBits += bitsPerIndex;
+                if (usedBits == 8) {
+                    output.push_back(byte);
+                    byte = 0;
+                    usedBits = 0;
+                }
+            }
+
+            if (usedBits > 0) {
+                output.push_back(byte << (8 - usedBits));
+            }
+        }
+        break;
+
+    case Subencoding::PlainRLE:
+    case Subencoding::PaletteRLE: {
+        bool usePalette = subencoding == Subencoding::PaletteRLE;
+
+        if (usePalette) {
+            output.push_back(128 + palette.size());
+            for (std::size_t i = 0; i < palette.size(); i++) {
+                writeCompressedPixel(palette.colour(i), output);
+            }
+        } else {
+            output.push_back(128);
+        }
+
+        uint32_t runPixel = readPixel(pixels);
+        std::size_t runLength = 0;
+
+        auto writeRun = [&]() {
+            if (!usePalette) {
+                writeCompressedPixel(runPixel, output);
+                writeRunLength(runLength, output);
+            } else if (runLength == 1) {
+                output.push_back(palette.index(runPixel));
+            } else {
+                output.push_back(palette.index(runPixel) | 128);
+                writeRunLength(runLength, output);
+            }
+        };
+
+        for (int y = 0; y < height; y++) {
+            const uint8_t *row = pixels + y * stride;
+            for (int x = 0; x < width; x++) {
+                uint32_t pixel = readPixel(row + x * m_bytesPerPixel);
+                if (pixel != runPixel) {
+                    writeRun();
+                    runPixel = pixel;
+                    runLength = 0;
+                }
+                runLength++;
+            }
+        }
+        writeRun();
+        break;
+    }
+    }
+}
+
+uint32_t ZRLEEncoder::readPixel(const uint8_t *src) const
+{
+    // The value keeps the bytes in their order in memory, it is only compared and written back.
+    uint32_t pixel = 0;
+    std::memcpy(&pixel, src, m_bytesPerPixel);
+    return pixel;
+}
+
+void ZRLEEncoder::writeCompressedPixel(uint32_t pixel, std::vector<uint8_t> &output) const
+{
+    const uint8_t *bytes = (const uint8_t *)&pixel + m_compressedPixelOffset;
+    output.insert(output.end(), bytes, bytes + m_compressedPixelSize);
+}
+
+void ZRLEEncoder::writeRunLength(std::size_t length, std::vector<uint8_t> &output)
+{
+    length--;
+    while (length >= 255) {
+        output.push_back(255);
+        length -= 255;
+    }
+    output.push_back(length);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016 Michal Srb <michalsrb@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef ZRLEENCODER_H
+#define ZRLEENCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "rfb.h"
+#include "DeflateStreams.h"
+#include "Region.h"
+
+
+/**
+ * @brief a class that encodes pixels into ZRLE rectangles.
+ *
+ * ZRLE sends all rectangles through a single zlib stream of the connection. Rectangles are compressed independently, see DeflateStreams.
+ *
+ * @remark Method encode() can be called from multiple threads at once. Changing the pixel format requires external synchronization.
+ */
+class ZRLEEncoder
+{
+public:
+    static constexpr int TileSize = 64;
+    static constexpr int CompressionLevel = 6;
+    static constexpr std::size_t MaxPaletteSize = 127;
+
+public:
+    ZRLEEncoder();
+
+    /**
+     * Set pixel format of the pixels given to encode(). It must be true colour.
+     */
+    void setPixelFormat(const PixelFormat &pixelFormat);
+
+    /**
+     * @brief Encode the rectangle and append it including its header to output.
+     *
+     * @param rect Position of the rectangle in framebuffer.
+     * @param pixels Pixels of the rectangle in the pixel format set by setPixelFormat().
+     * @param stride Distance between rows of pixels in bytes.
+     * @param output Buffer where the rectangle is appended.
+     * @param chunks The compressed chunk is recorded here, it has to be passed to DeflateStreams::start() before sending.
+     */
+    void encode(const Rect &rect, const uint8_t *pixels, std::size_t stride, std::vector<uint8_t> &output, std::vector<DeflateStreams::Chunk> &chunks) const;
+
+private:
+    void encodeTile(const uint8_t *pixels, std::size_t stride, int width, int height, std::vector<uint8_t> &output) const;
+
+    uint32_t readPixel(const uint8_t *src) const;
+    void writeCompressedPixel(uint32_t pixel, std::vector<uint8_t> &output) const;
+
+    static void writeRunLength(std::size_t length, std::vector<uint8_t> &output);
+
+private:
+    int m_bytesPerPixel = 4;
+
+    // ZRLE sends 32 bit pixels with unused byte as three bytes.
+    int m_compressedPixelSize = 4;
+    int m_compressedPixelOffset = 0;
+};
+
+#endif // ZRLEENCODER_H
@@ -27,9 +27,14 @@
 #ifndef HELPER_H
 #define HELPER_H
 
+#include <signal.h>
 #include <unistd.h>
 
+#include <pthread.h>
+
 #include <system_error>
+#include <thread>
+#include <utility>
 
 #include <gnutls/gnutls.h>
 
@@ -58,6 +63,23 @@ inline void throw_errno(const std::string &what_arg)
     throw std::system_error(errno, std::system_category(), what_arg);
 }
 
+/**
+ * Helper function to start std::thread with all signals blocked. Signals are handled by the Server in the main thread.
+ */
+template<class Function, class... Args>
+std::thread start_thread(Function &&function, Args &&... args)
+{
+    sigset_t allSignals, originalSignals;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &originalSignals);
+
+    std::thread thread(std::forward<Function>(function), std::forward<Args>(args)...);
+
+    pthread_sigmask(SIG_SETMASK, &originalSignals, nullptr);
+
+    return thread;
+}
+
 /**
  * EOF for Stream.
  */
@@ -75,9 +75,10 @@ enum class EncodingType : int32_t
     Raw = 0,
     CopyRect = 1,
     RRE = 2,
-//   Hextile = 5, // TODO?
+    Hextile = 5,
+    Zlib = 6,
     Tight = 7,
-//   ZRLE = 16,   // TODO?
+    ZRLE = 16,
 
     JpegQualityLowest = -32,
     JpegQualityHighest = -23,
@@ -113,16 +114,21 @@ struct PixelFormat {
 
     uint8_t _padding[3] = { 0, 0, 0 };
 
+    // Note: bigEndianFlag describes the pixel data, the members of this structure are always in network order.
     void ntoh() {
-        if (bigEndianFlag) {
-            redMax = ntohs(redMax);
-            greenMax = ntohs(greenMax);
-            blueMax = ntohs(blueMax);
-        }
+        redMax = ntohs(redMax);
+        greenMax = ntohs(greenMax);
+        blueMax = ntohs(blueMax);
     }
 
     void hton() {
-        bigEndianFlag = (__BYTE_ORDER == __BIG_ENDIAN);
+        redMax = htons(redMax);
+        greenMax = htons(greenMax);
+        blueMax = htons(blueMax);
+    }
+
+    int bytesPerPixel() const {
+        return bitsPerPixel / 8;
     }
 
     bool operator==(const PixelFormat &another) const {
@@ -552,6 +558,18 @@ enum class TightFilter : uint8_t
     Gradient = 2
 };
 
+// Bit flags of the subencoding byte that starts every Hextile tile.
+enum HextileSubencoding : uint8_t
+{
+    HextileRaw = 1,
+    HextileBackgroundSpecified = 2,
+    HextileForegroundSpecified = 4,
+    HextileAnySubrects = 8,
+    HextileSubrectsColoured = 16
+};
+
+constexpr int HextileTileSize = 16;
+
 constexpr int TightMinSizeToCompress = 12;
 
 #pragma pack(pop)